@@ -0,0 +1,41 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <SDL2/SDL.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "chip8.h"
+#include "config.h"
+
+struct Batch;
+
+// The machines one thread runs
+struct BatchWorker {
+  struct Batch *batch;
+  int first;
+  int count;
+  SDL_Thread *thread;
+};
+
+// Many independent copies of one program, each with its own seed and keys,
+// for fuzzing and ROM-farm runs. The machines never interact, so they are
+// split across one thread per CPU, and each thread runs its machines one
+// after another to the last frame without waiting on the others.
+struct Batch {
+  int machines;
+  struct Chip8 *chips;
+  int frames;
+  // Keys machine holds during frame, as a bit mask
+  unsigned short (*keys)(int machine, int frame);
+  int threads;
+  struct BatchWorker workers[BATCH_MAX_THREADS];
+};
+
+bool batch_init(struct Batch *batch, int machines, const unsigned char *program,
+                size_t size);
+void batch_free(struct Batch *batch);
+void batch_run(struct Batch *batch, int frames,
+               unsigned short (*keys)(int machine, int frame));
+
+#endif
@@ -0,0 +1,88 @@
+#ifndef BLOCK_CACHE_H
+#define BLOCK_CACHE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "chip8.h"
+#include "config.h"
+
+enum BlockOpKind {
+  // Not decoded yet
+  BLOCK_OP_NONE,
+  // Executed by chip8_exec
+  BLOCK_OP_EXEC,
+  BLOCK_OP_LOAD,
+  BLOCK_OP_ADD,
+  BLOCK_OP_LOAD_I,
+  BLOCK_OP_ADD_I,
+  // FX33 and FX55, which may overwrite code
+  BLOCK_OP_STORE,
+  // 6XNN 7XNN on the same register, folded into a single load
+  BLOCK_OP_LOAD_ADD,
+  // 3XNN, 4XNN, 5XY0 or 9XY0 followed by 1NNN
+  BLOCK_OP_SKIP_JUMP,
+  // FX1E FY65, indexing into a table and loading from it
+  BLOCK_OP_ADD_I_LOAD,
+};
+
+// An instruction, or a fused sequence of instructions, decoded once. Plain
+// data so that the table can be mapped straight from a cache file.
+struct BlockOp {
+  unsigned char kind;
+  // Instructions this op stands for
+  unsigned char count;
+  unsigned char x;
+  unsigned char y;
+  unsigned char nn;
+  unsigned char reserved;
+  unsigned short nnn;
+  // The original instructions, for chip8_exec and for validation
+  unsigned short opcode;
+  unsigned short opcode2;
+};
+
+// Layout of a cache file: this header followed by one op per address
+struct BlockCacheHeader {
+  char magic[4];
+  unsigned int version;
+  unsigned int op_size;
+  unsigned int rom_size;
+  unsigned long long rom_hash;
+  // FNV-1a of the op table
+  unsigned long long checksum;
+};
+
+// Decoded ops of one ROM, indexed by the address they start at. Basic blocks
+// are decoded the first time execution reaches them and kept across runs in
+// a file keyed by the ROM's hash, so later launches start with every block
+// the ROM has run before.
+struct BlockCache {
+  struct BlockOp *ops;
+  // The cache file, when ops points into it
+  void *mapping;
+  size_t mapping_size;
+  // Addresses the program has written to since it was loaded
+  bool written[MEMORY_SIZE];
+  unsigned long long rom_hash;
+  unsigned int rom_size;
+  // Ops loaded from the cache file and decoded during this run
+  int loaded;
+  int decoded;
+};
+
+bool block_cache_init(struct BlockCache *cache, const unsigned char *rom,
+                      size_t size);
+void block_cache_free(struct BlockCache *cache);
+bool block_cache_path(const struct BlockCache *cache, char *path,
+                      size_t size);
+bool block_cache_load(struct BlockCache *cache, const char *path,
+                      struct Memory *memory);
+bool block_cache_save(struct BlockCache *cache, const char *path);
+int block_cache_step(struct BlockCache *cache, struct Chip8 *chip8,
+                     int budget);
+void block_cache_invalidate(struct BlockCache *cache, int address,
+                            int length);
+void block_cache_invalidate_written(struct BlockCache *cache);
+
+#endif
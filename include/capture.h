@@ -0,0 +1,45 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <SDL2/SDL.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+#include "config.h"
+#include "display.h"
+#include "framebuffer.h"
+#include "spsc.h"
+
+struct CaptureSlot {
+  // Swapped with the producer's frame rather than copied into
+  struct Frame *frame;
+  unsigned long number;
+  bool sound;
+  // False when the frame repeats the previous one and was not taken
+  bool changed;
+};
+
+// Records every emulated frame to a file. The emulation thread hands a
+// finished frame to a free slot of a bounded ring and gets the slot's old
+// frame back in exchange; a background thread delta-codes and writes it.
+struct Capture {
+  struct CaptureSlot slots[CAPTURE_RING_SIZE];
+  struct Frame frames[CAPTURE_RING_SIZE];
+  struct Spsc ring;
+  unsigned long next_number;
+  // Set when a changed frame was dropped, which left it with the producer
+  bool dropped;
+  FILE *file;
+  SDL_sem *ready;
+  atomic_bool running;
+  SDL_Thread *thread;
+};
+
+bool capture_start(struct Capture *capture, const char *path);
+bool capture_submit(struct Capture *capture, struct Frame **frame,
+                    bool changed, bool sound);
+void capture_stop(struct Capture *capture);
+bool capture_export_y4m(const char *input_path, const char *output_path);
+
+#endif
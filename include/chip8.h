@@ -7,20 +7,84 @@
 #include "memory.h"
 #include "registers.h"
 #include "stack.h"
+#include <stdbool.h>
 #include <stddef.h>
 
+// Why the last executed instruction left the program spinning, if it did
+enum Chip8Idle {
+  CHIP8_IDLE_NONE,
+  // Polling the delay timer (or looping forever) until the next timer tick
+  CHIP8_IDLE_TIMER,
+  // Polling the keypad or blocked in FX0A until the next key event
+  CHIP8_IDLE_KEY,
+};
+
+// Changes to the sound output, logged with the emulated cycle they happen on
+// so that the audio thread can place them exactly on its own timeline
+enum Chip8SoundEvent {
+  CHIP8_SOUND_ON,
+  CHIP8_SOUND_OFF,
+  // XO-CHIP F002 loaded a new audio pattern
+  CHIP8_SOUND_PATTERN,
+  // XO-CHIP FX3A changed the pattern playback rate
+  CHIP8_SOUND_PITCH,
+};
+
+struct Chip8Sound {
+  unsigned long long cycle;
+  enum Chip8SoundEvent type;
+  // Audio state after the change
+  unsigned char pitch;
+  unsigned char pattern[AUDIO_PATTERN_SIZE];
+};
+
 struct Chip8 {
   struct Memory memory;
   struct Registers registers;
   struct Stack stack;
   struct Keyboard keyboard;
   struct Display display;
+  enum Chip8Idle idle;
+  // Bounds of the polling loop seen on the previous backwards jump
+  unsigned short idle_loop_start;
+  unsigned short idle_loop_end;
+  bool waiting_for_key;
+  // State of the random number generator used by CXNN
+  unsigned int rng;
+  // Emulated time in cycles since power on
+  unsigned long long cycle;
+  // XO-CHIP audio pattern and its playback pitch
+  unsigned char audio_pattern[AUDIO_PATTERN_SIZE];
+  unsigned char pitch;
+  // Sound changes since the owner last drained the log
+  struct Chip8Sound sound_log[SOUND_LOG_SIZE];
+  int sound_log_count;
 };
 
+// xorshift32, so that a run is reproducible from its seed
+static inline unsigned char chip8_random(unsigned int *state) {
+  unsigned int x = *state;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  *state = x;
+  return x >> 24;
+}
+
+static inline unsigned int chip8_random_state(unsigned int seed) {
+  // xorshift never leaves the all-zero state
+  return seed ? seed : 0x9E3779B9;
+}
+
 void chip8_init(struct Chip8 *chip8);
 void chip8_load_program(struct Chip8 *chip8, const unsigned char *program,
                         size_t size);
 void chip8_exec(struct Chip8 *chip8, unsigned short opcode);
+void chip8_begin_cycle(struct Chip8 *chip8);
 void chip8_cycle(struct Chip8 *chip8);
+void chip8_seed(struct Chip8 *chip8, unsigned int seed);
+void chip8_copy_state(struct Chip8 *chip8, const struct Chip8 *from);
+void chip8_tick_timers(struct Chip8 *chip8);
+void chip8_log_sound(struct Chip8 *chip8, enum Chip8SoundEvent type);
 
 #endif
\ No newline at end of file
@@ -19,9 +19,46 @@
 #define PROGRAM_START_ADDRESS 0x200
 
 #define KEY_COUNT 16
+// Bytes in an XO-CHIP audio pattern, played one bit at a time
+#define AUDIO_PATTERN_SIZE 16
+// Sound changes a frame can log before further changes are dropped
+#define SOUND_LOG_SIZE 32
+#define INPUT_QUEUE_SIZE 256
+// Players sharing the keypad in multi-seat mode, each owning half the keys
+#define SEAT_COUNT 2
+// Frames of history kept to re-simulate input that arrives late
+#define ROLLBACK_FRAMES 8
+// Input events a single frame can hold
+#define ROLLBACK_FRAME_EVENTS 32
+
+#define METRICS_MAX_THREADS 8
+
+// Sound changes buffered between the emulation and audio threads
+#define SYNTH_QUEUE_SIZE 256
+// Samples rendered and written to the audio device at a time
+#define SYNTH_PERIOD 256
+// How far the audio timeline trails the emulated one, in frames. Must cover
+// the audio device buffer so that changes arrive before they are rendered.
+#define SYNTH_LATENCY_FRAMES 3
+
+// Frames buffered between the emulation thread and the capture encoder
+#define CAPTURE_RING_SIZE 64
+// Frames between self-contained frames in a capture
+#define CAPTURE_KEYFRAME_INTERVAL 300
+
+// Machines per batch run, and threads it spreads them over
+#define BATCH_MAX_MACHINES 256
+#define BATCH_MAX_THREADS 64
+
+// Bumped whenever the layout or meaning of a block cache file changes
+#define BLOCK_CACHE_VERSION 1
 
 #define CYCLES_PER_SECOND 500
 #define CYCLES_PER_FRAME 10
+#define FRAMES_PER_SECOND 60
+
+// Longest polling loop, in instructions, recognised as idle
+#define IDLE_LOOP_MAX_LENGTH 4
 
 
 #endif
\ No newline at end of file
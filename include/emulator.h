@@ -0,0 +1,62 @@
+#ifndef EMULATOR_H
+#define EMULATOR_H
+
+#include <SDL2/SDL.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+
+#include "block_cache.h"
+#include "capture.h"
+#include "chip8.h"
+#include "framebuffer.h"
+#include "generate_sound.h"
+#include "input.h"
+#include "metrics.h"
+#include "rollback.h"
+
+// Runs the CHIP-8 core on its own thread at FRAMES_PER_SECOND. The host
+// thread feeds it through the input queue and receives completed frames
+// through the triple buffer and sound changes through the tone's synth.
+struct Emulator {
+  struct Chip8 chip8;
+  struct InputQueue input;
+  struct TripleBuffer frames;
+  // Optional, NULL when running without sound
+  struct Tone *tone;
+  // Optional, NULL when not recording
+  struct Capture *capture;
+  // With one seat, the frame handed to the capture with the next change.
+  // It is swapped for a free one each time, so it starts out as
+  // capture_frame_storage but can be any frame of the capture's ring.
+  struct Frame *capture_frame;
+  struct Frame capture_frame_storage;
+  // Optional, NULL to run the plain interpreter
+  struct BlockCache *blocks;
+  // Frames to run before pushing SDL_QUIT, 0 to run until stopped
+  unsigned long frame_limit;
+  // Frames input is held back before it reaches the core
+  int input_delay;
+  // With more than one seat, input that misses its frame rolls the machine
+  // back to that frame instead of landing in the next one
+  int seats;
+  struct Rollback rollback;
+  // Oldest key event applied since the last published frame
+  Uint32 unshown_input;
+  bool has_unshown_input;
+  struct MetricsCounters *counters;
+  // SDL event type pushed to the host when a new frame is published
+  Uint32 frame_event;
+  atomic_bool frame_event_pending;
+  atomic_bool running;
+  SDL_Thread *thread;
+};
+
+void emulator_init(struct Emulator *emulator, struct Tone *tone,
+                   struct MetricsCounters *counters);
+bool emulator_start(struct Emulator *emulator);
+void emulator_stop(struct Emulator *emulator);
+int emulator_run_frame(struct Emulator *emulator,
+                       const struct RollbackFrame *frame);
+int emulator_advance(struct Emulator *emulator, Uint32 start, Uint32 frame_ms);
+
+#endif
@@ -0,0 +1,39 @@
+#ifndef FRAMEBUFFER_H
+#define FRAMEBUFFER_H
+
+#include <SDL2/SDL.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+
+#include "config.h"
+
+struct Frame {
+  bool pixels[DISPLAY_HEIGHT][DISPLAY_WIDTH];
+  // Emulated frame the pixels come from
+  unsigned long number;
+  // Host time of the oldest key event this frame is the first to show
+  Uint32 input_timestamp;
+  bool has_input;
+};
+
+// Lock-free handoff of completed frames from one producer to one consumer.
+// The producer owns the back frame, the consumer owns the front frame and
+// the two swap through the middle one, so neither ever waits on the other.
+// The consumer always acquires the newest completed frame; a frame that is
+// overtaken before it is acquired is never shown.
+struct TripleBuffer {
+  struct Frame frames[3];
+  // Index of the middle frame, plus TRIPLE_BUFFER_FRESH when it holds a
+  // frame the consumer has not seen yet
+  atomic_int middle;
+  int back;
+  int front;
+};
+
+void triple_buffer_init(struct TripleBuffer *buffer);
+struct Frame *triple_buffer_back(struct TripleBuffer *buffer);
+void triple_buffer_publish(struct TripleBuffer *buffer);
+bool triple_buffer_acquire(struct TripleBuffer *buffer);
+const struct Frame *triple_buffer_front(struct TripleBuffer *buffer);
+
+#endif
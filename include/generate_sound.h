@@ -1,8 +1,28 @@
 #ifndef GENERATE_SOUND_H
 #define GENERATE_SOUND_H
 
+#include <SDL2/SDL.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 
-bool beep(int frequency, int duration, float volume);
+#include "metrics.h"
+#include "synth.h"
+
+// Audio output thread. The emulation thread pushes the core's sound changes
+// into the synth, and the audio thread renders them to the PCM device,
+// sleeping while the tone is silent. The device is opened on the first sound.
+struct Tone {
+  struct Synth synth;
+  atomic_bool running;
+  atomic_bool sleeping;
+  SDL_sem *wake;
+  SDL_Thread *thread;
+  struct MetricsCounters *counters;
+};
+
+bool tone_start(struct Tone *tone, int frequency, float volume,
+                struct MetricsCounters *counters);
+void tone_push(struct Tone *tone, const struct Chip8Sound *sound);
+void tone_stop(struct Tone *tone);
 
 #endif // GENERATE_SOUND_H
@@ -0,0 +1,61 @@
+#ifndef INPUT_H
+#define INPUT_H
+
+#include <SDL2/SDL.h>
+#include <stdbool.h>
+
+#include "config.h"
+#include "keyboard.h"
+#include "spsc.h"
+
+// A key press or release, already mapped to a CHIP-8 key
+struct InputEvent {
+  // Host time of the event in milliseconds, as reported by SDL
+  Uint32 timestamp;
+  // Frame the event arrived for: the one after the frame on screen when the
+  // host received it. SDL stamps events when they are pumped, which says
+  // nothing about what the player was reacting to.
+  unsigned long frame;
+  unsigned char key;
+  bool pressed;
+};
+
+// Input events on their way from the host thread, which pushes, to the
+// emulation thread, which peeks and pops
+struct InputQueue {
+  struct InputEvent events[INPUT_QUEUE_SIZE];
+  struct Spsc ring;
+};
+
+// Direct scancode to CHIP-8 key lookup, -1 for unmapped scancodes. With
+// several seats the keyboard is split into one block of keys per seat. Game
+// controllers take a seat in the order they are connected and drive the
+// keys of that seat.
+struct InputMap {
+  signed char keys[SDL_NUM_SCANCODES];
+  int seats;
+  // Instance id of the controller in each seat, -1 for an empty seat
+  SDL_JoystickID controllers[SEAT_COUNT];
+};
+
+// Keys of each seat: the left two keypad columns for seat 0 and the right
+// two for seat 1, outer column first
+extern const unsigned char input_seat_keys[SEAT_COUNT][KEY_COUNT / SEAT_COUNT];
+
+void input_map_init(
+    struct InputMap *map, const SDL_Scancode *scancodes,
+    const SDL_Scancode (*seat_scancodes)[KEY_COUNT / SEAT_COUNT], int seats);
+int input_map_key(const struct InputMap *map, SDL_Scancode scancode);
+int input_map_add_controller(struct InputMap *map, SDL_JoystickID id);
+void input_map_remove_controller(struct InputMap *map, SDL_JoystickID id);
+int input_map_controller_key(const struct InputMap *map, SDL_JoystickID id,
+                             SDL_GameControllerButton button);
+
+void input_queue_init(struct InputQueue *queue);
+bool input_queue_push(struct InputQueue *queue, const struct InputEvent *event);
+bool input_queue_peek(struct InputQueue *queue, struct InputEvent *event);
+void input_queue_pop(struct InputQueue *queue);
+unsigned input_queue_size(struct InputQueue *queue);
+void input_apply(struct Keyboard *keyboard, const struct InputEvent *event);
+
+#endif
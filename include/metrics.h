@@ -0,0 +1,72 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <SDL2/SDL.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+
+#include "config.h"
+#include "input.h"
+
+enum MetricsCounter {
+  METRIC_INSTRUCTIONS,
+  METRIC_FRAMES_EMULATED,
+  METRIC_FRAMES_PRESENTED,
+  METRIC_FRAMES_LATE,
+  METRIC_FRAMES_DROPPED,
+  METRIC_DRAW_NS,
+  METRIC_AUDIO_NS,
+  METRIC_KEY_WAIT_FRAMES,
+  METRIC_CAPTURE_DROPPED,
+  METRIC_ROLLBACKS,
+  METRIC_FRAMES_RESIMULATED,
+  METRIC_INPUT_LATENCY_MS,
+  METRIC_INPUT_LATENCY_SAMPLES,
+  METRIC_COUNT,
+};
+
+// Counters owned by a single thread. Only the owner writes them, so updates
+// are plain relaxed stores and readers sum every thread's copy.
+struct MetricsCounters {
+  _Alignas(64) atomic_ullong values[METRIC_COUNT];
+};
+
+struct Metrics {
+  struct MetricsCounters threads[METRICS_MAX_THREADS];
+  atomic_int thread_count;
+  struct InputQueue *input;
+  Uint64 start;
+  // Unix socket serving the counters, -1 when disabled, and its path
+  int listen_fd;
+  const char *socket_path;
+  // Seconds between stderr dumps, 0 when disabled
+  int dump_interval;
+  atomic_bool running;
+  SDL_Thread *thread;
+};
+
+void metrics_init(struct Metrics *metrics, struct InputQueue *input);
+struct MetricsCounters *metrics_register(struct Metrics *metrics);
+void metrics_read(struct Metrics *metrics,
+                  unsigned long long values[METRIC_COUNT]);
+bool metrics_start(struct Metrics *metrics, const char *socket_path,
+                   int dump_interval);
+void metrics_stop(struct Metrics *metrics);
+
+static inline void metrics_add(struct MetricsCounters *counters,
+                               enum MetricsCounter counter,
+                               unsigned long long value) {
+  atomic_ullong *slot = &counters->values[counter];
+  atomic_store_explicit(
+      slot, atomic_load_explicit(slot, memory_order_relaxed) + value,
+      memory_order_relaxed);
+}
+
+static inline Uint64 metrics_now_ns(void) {
+  Uint64 counter = SDL_GetPerformanceCounter();
+  Uint64 frequency = SDL_GetPerformanceFrequency();
+  return counter / frequency * 1000000000ULL +
+         counter % frequency * 1000000000ULL / frequency;
+}
+
+#endif
@@ -0,0 +1,52 @@
+#ifndef ROLLBACK_H
+#define ROLLBACK_H
+
+#include <SDL2/SDL.h>
+#include <stdbool.h>
+
+#include "chip8.h"
+#include "config.h"
+#include "framebuffer.h"
+#include "input.h"
+
+// An emulated frame kept for re-simulation: the host interval it covers,
+// the input events that land in it and the machine state it started from
+struct RollbackFrame {
+  unsigned long number;
+  Uint32 start;
+  Uint32 frame_ms;
+  struct InputEvent events[ROLLBACK_FRAME_EVENTS];
+  int event_count;
+  // Filled by chip8_copy_state, so only the machine state is meaningful
+  struct Chip8 state;
+  // What the frame showed and whether it sounded, as last emulated. Only
+  // kept while capturing, which waits until the frame can no longer change
+  // and then swaps the frame out for a free one.
+  struct Frame *output;
+  bool sound;
+};
+
+// History of the last ROLLBACK_FRAMES frames. When input arrives for a frame
+// that has already been emulated, the frame is marked dirty so that the
+// machine can be restored to it and run forward again.
+struct Rollback {
+  struct RollbackFrame frames[ROLLBACK_FRAMES];
+  struct Frame outputs[ROLLBACK_FRAMES];
+  // Frames oldest to next - 1 are in the history
+  unsigned long oldest;
+  unsigned long next;
+  // Oldest frame whose input changed after it was emulated, next if none
+  unsigned long dirty;
+};
+
+void rollback_init(struct Rollback *rollback);
+struct RollbackFrame *rollback_push(struct Rollback *rollback, Uint32 start,
+                                    Uint32 frame_ms);
+struct RollbackFrame *rollback_get(struct Rollback *rollback,
+                                   unsigned long number);
+void rollback_mark(struct Rollback *rollback,
+                   const struct RollbackFrame *frame);
+bool rollback_add_event(struct RollbackFrame *frame,
+                        const struct InputEvent *event);
+
+#endif
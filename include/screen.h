@@ -0,0 +1,20 @@
+#ifndef SCREEN_H
+#define SCREEN_H
+
+#include <SDL2/SDL.h>
+
+#include "framebuffer.h"
+
+// Host side of the display: the emulator only writes pixels, the host owns
+// the window and presents published frames
+struct Screen {
+  SDL_Window *window;
+  SDL_Renderer *renderer;
+  SDL_Texture *texture;
+};
+
+void screen_init(struct Screen *screen);
+void screen_draw(struct Screen *screen, const struct Frame *frame);
+void screen_free(struct Screen *screen);
+
+#endif
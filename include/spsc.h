@@ -0,0 +1,30 @@
+#ifndef SPSC_H
+#define SPSC_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// Bounded single-producer/single-consumer ring over a caller-owned array of
+// fixed-size elements. The producer fills the slot returned by spsc_back and
+// publishes it with spsc_push; the consumer reads the slot returned by
+// spsc_front and frees it with spsc_pop. Elements are used in place, so
+// neither side copies them through the ring, and neither side locks.
+struct Spsc {
+  unsigned char *elements;
+  size_t size;
+  // A power of two, so the free-running indices wrap cleanly
+  unsigned capacity;
+  _Alignas(64) atomic_uint head;
+  _Alignas(64) atomic_uint tail;
+};
+
+void spsc_init(struct Spsc *spsc, void *elements, size_t size,
+               unsigned capacity);
+void *spsc_back(struct Spsc *spsc);
+void spsc_push(struct Spsc *spsc);
+void *spsc_front(struct Spsc *spsc);
+void spsc_pop(struct Spsc *spsc);
+unsigned spsc_size(struct Spsc *spsc);
+
+#endif
@@ -0,0 +1,74 @@
+#ifndef SYNTH_H
+#define SYNTH_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "chip8.h"
+#include "config.h"
+#include "spsc.h"
+
+// Half the length of the band-limited step, in samples
+#define SYNTH_BLEP_ZERO_CROSSINGS 8
+#define SYNTH_BLEP_TAPS (2 * SYNTH_BLEP_ZERO_CROSSINGS)
+// Table entries per sample of the band-limited step
+#define SYNTH_BLEP_OVERSAMPLING 64
+
+// Renders the sound changes logged by the core on the emulated timeline. The
+// emulation thread pushes changes and the emulated time; the audio thread
+// renders samples trailing that time by SYNTH_LATENCY_FRAMES.
+//
+// The tone is a one-bit pattern oscillator: a two-bit square at the tone
+// frequency until a program loads an XO-CHIP pattern. Every level change,
+// whether a pattern bit or the tone switching on or off, is placed at its
+// fractional sample position through a precomputed band-limited step, so
+// edges neither alias nor click.
+struct Synth {
+  // Changes pushed by the emulation thread
+  struct Chip8Sound events[SYNTH_QUEUE_SIZE];
+  struct Spsc queue;
+  // Latest emulated cycle, published by the emulation thread
+  _Alignas(64) atomic_ullong cycle;
+
+  // Everything below belongs to the audio thread
+  int frequency;
+  float amplitude;
+  double samples_per_cycle;
+  // Output sample n is rendered at emulated cycle origin + n /
+  // samples_per_cycle
+  unsigned long long sample;
+  double origin;
+  // Samples since the last level change, to know when the output is silent
+  int settled;
+
+  bool on;
+  unsigned char pitch;
+  unsigned char pattern[AUDIO_PATTERN_SIZE];
+  int pattern_bits;
+  // Position in the pattern and its advance per sample, in bits
+  double phase;
+  double increment;
+  double square_increment;
+  float level;
+
+  // Pending output around the current sample, with the step corrections
+  // that still have to reach it
+  float line[SYNTH_BLEP_TAPS];
+  // Band-limited step minus the ideal step, indexed by the step offset from
+  // -SYNTH_BLEP_ZERO_CROSSINGS to SYNTH_BLEP_ZERO_CROSSINGS samples, plus a
+  // copy of the last entry so a step a whole sample back can interpolate
+  float blep[SYNTH_BLEP_TAPS * SYNTH_BLEP_OVERSAMPLING + 2];
+  // XO-CHIP pattern rate in bits per sample for each pitch
+  double pitch_increment[256];
+};
+
+void synth_init(struct Synth *synth, int frequency, float volume);
+void synth_set_rate(struct Synth *synth, int sample_rate);
+bool synth_push(struct Synth *synth, const struct Chip8Sound *sound);
+void synth_set_cycle(struct Synth *synth, unsigned long long cycle);
+void synth_sync(struct Synth *synth);
+bool synth_idle(struct Synth *synth);
+void synth_render(struct Synth *synth, int16_t *buffer, int samples);
+
+#endif
@@ -0,0 +1,109 @@
+#include "batch.h"
+#include "keyboard.h"
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+bool batch_init(struct Batch *batch, int machines, const unsigned char *program,
+                size_t size) {
+  assert(machines > 0 && machines <= BATCH_MAX_MACHINES);
+  batch->machines = machines;
+  batch->chips = malloc(sizeof(struct Chip8) * machines);
+  if (!batch->chips) {
+    fprintf(stderr, "Error: Could not allocate memory for batch\n");
+    return false;
+  }
+
+  for (int i = 0; i < machines; i++) {
+    chip8_init(&batch->chips[i]);
+    chip8_load_program(&batch->chips[i], program, size);
+    chip8_seed(&batch->chips[i], i);
+  }
+
+  return true;
+}
+
+void batch_free(struct Batch *batch) {
+  free(batch->chips);
+  batch->chips = NULL;
+}
+
+static void batch_press_keys(struct Chip8 *chip8, unsigned short held,
+                             unsigned short keys) {
+  for (int key = 0; key < KEY_COUNT; key++) {
+    if ((keys & ~held) & (1 << key)) {
+      keyboard_press(&chip8->keyboard, key);
+    } else if ((held & ~keys) & (1 << key)) {
+      keyboard_release(&chip8->keyboard, key);
+    }
+  }
+}
+
+static int batch_worker(void *data) {
+  // One machine at a time from start to finish, so that only its state has
+  // to stay in cache
+  struct BatchWorker *worker = data;
+  struct Batch *batch = worker->batch;
+
+  for (int i = worker->first; i < worker->first + worker->count; i++) {
+    struct Chip8 *chip8 = &batch->chips[i];
+    unsigned short held = 0;
+    for (int frame = 0; frame < batch->frames; frame++) {
+      unsigned short keys = batch->keys(i, frame);
+      batch_press_keys(chip8, held, keys);
+      held = keys;
+      for (int cycle = 0; cycle < CYCLES_PER_FRAME; cycle++) {
+        chip8_cycle(chip8);
+      }
+      chip8_tick_timers(chip8);
+      chip8->sound_log_count = 0;
+    }
+  }
+
+  return 0;
+}
+
+void batch_run(struct Batch *batch, int frames,
+               unsigned short (*keys)(int machine, int frame)) {
+  // Run every machine for frames frames, then return
+  batch->frames = frames;
+  batch->keys = keys;
+  batch->threads = SDL_GetCPUCount();
+  if (batch->threads > BATCH_MAX_THREADS) {
+    batch->threads = BATCH_MAX_THREADS;
+  }
+  if (batch->threads > batch->machines) {
+    batch->threads = batch->machines;
+  }
+  if (batch->threads < 1) {
+    batch->threads = 1;
+  }
+
+  int first = 0;
+  for (int i = 0; i < batch->threads; i++) {
+    struct BatchWorker *worker = &batch->workers[i];
+    worker->batch = batch;
+    worker->first = first;
+    worker->count = (batch->machines - first) / (batch->threads - i);
+    first += worker->count;
+  }
+
+  // This thread runs the first share itself, and any share that could not
+  // get a thread of its own
+  for (int i = 1; i < batch->threads; i++) {
+    struct BatchWorker *worker = &batch->workers[i];
+    worker->thread = SDL_CreateThread(batch_worker, "batch", worker);
+    if (worker->thread == NULL) {
+      fprintf(stderr, "SDL_CreateThread Error: %s\n", SDL_GetError());
+    }
+  }
+  batch_worker(&batch->workers[0]);
+  for (int i = 1; i < batch->threads; i++) {
+    struct BatchWorker *worker = &batch->workers[i];
+    if (worker->thread) {
+      SDL_WaitThread(worker->thread, NULL);
+    } else {
+      batch_worker(worker);
+    }
+  }
+}
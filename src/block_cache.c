@@ -0,0 +1,456 @@
+#include "block_cache.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define BLOCK_CACHE_MAGIC "C8BC"
+// Longest op in bytes, so a write can only affect ops starting this close
+// before it
+#define BLOCK_OP_MAX_BYTES 4
+
+static unsigned long long fnv1a(unsigned long long hash, const void *data,
+                                size_t size) {
+  const unsigned char *bytes = data;
+  for (size_t i = 0; i < size; i++) {
+    hash ^= bytes[i];
+    hash *= 0x100000001B3ULL;
+  }
+  return hash;
+}
+
+#define FNV1A_OFFSET 0xCBF29CE484222325ULL
+
+bool block_cache_init(struct BlockCache *cache, const unsigned char *rom,
+                      size_t size) {
+  cache->ops = calloc(MEMORY_SIZE, sizeof(struct BlockOp));
+  if (!cache->ops) {
+    fprintf(stderr, "Error allocating block cache\n");
+    return false;
+  }
+
+  cache->mapping = NULL;
+  cache->mapping_size = 0;
+  memset(cache->written, 0, sizeof(cache->written));
+  cache->rom_hash = fnv1a(FNV1A_OFFSET, rom, size);
+  cache->rom_size = size;
+  cache->loaded = 0;
+  cache->decoded = 0;
+  return true;
+}
+
+void block_cache_free(struct BlockCache *cache) {
+  if (cache->mapping) {
+    munmap(cache->mapping, cache->mapping_size);
+  } else {
+    free(cache->ops);
+  }
+  cache->ops = NULL;
+  cache->mapping = NULL;
+}
+
+bool block_cache_path(const struct BlockCache *cache, char *path,
+                      size_t size) {
+  // $XDG_CACHE_HOME/chip8, falling back to ~/.cache/chip8
+  const char *xdg = getenv("XDG_CACHE_HOME");
+  const char *home = getenv("HOME");
+  int length;
+  if (xdg && xdg[0] == '/') {
+    length = snprintf(path, size, "%s/chip8/%016llx.blocks", xdg,
+                      cache->rom_hash);
+  } else if (home && home[0] != '\0') {
+    length = snprintf(path, size, "%s/.cache/chip8/%016llx.blocks", home,
+                      cache->rom_hash);
+  } else {
+    return false;
+  }
+
+  return length > 0 && (size_t)length < size;
+}
+
+static bool block_op_matches(const struct BlockOp *op, struct Memory *memory,
+                             int address) {
+  if (op->kind == BLOCK_OP_NONE) {
+    return true;
+  }
+  if (op->kind > BLOCK_OP_ADD_I_LOAD || op->count < 1 || op->count > 2 ||
+      address + 2 * op->count > MEMORY_SIZE) {
+    return false;
+  }
+
+  return memory_read_short(memory, address) == op->opcode &&
+         (op->count == 1 ||
+          memory_read_short(memory, address + 2) == op->opcode2);
+}
+
+bool block_cache_load(struct BlockCache *cache, const char *path,
+                      struct Memory *memory) {
+  // Map the file privately, so invalidating ops never touches it
+  int fd = open(path, O_RDONLY);
+  if (fd == -1) {
+    return false;
+  }
+
+  size_t size =
+      sizeof(struct BlockCacheHeader) + MEMORY_SIZE * sizeof(struct BlockOp);
+  struct stat st;
+  if (fstat(fd, &st) == -1 || (size_t)st.st_size != size) {
+    close(fd);
+    return false;
+  }
+
+  void *mapping =
+      mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (mapping == MAP_FAILED) {
+    return false;
+  }
+
+  const struct BlockCacheHeader *header = mapping;
+  struct BlockOp *ops = (struct BlockOp *)(header + 1);
+  if (memcmp(header->magic, BLOCK_CACHE_MAGIC, sizeof(header->magic)) != 0 ||
+      header->version != BLOCK_CACHE_VERSION ||
+      header->op_size != sizeof(struct BlockOp) ||
+      header->rom_size != cache->rom_size ||
+      header->rom_hash != cache->rom_hash ||
+      header->checksum !=
+          fnv1a(FNV1A_OFFSET, ops, MEMORY_SIZE * sizeof(struct BlockOp))) {
+    fprintf(stderr, "Ignoring stale block cache %s\n", path);
+    munmap(mapping, size);
+    return false;
+  }
+
+  // Every op must still describe the instructions it was decoded from
+  int loaded = 0;
+  for (int address = 0; address < MEMORY_SIZE; address++) {
+    if (!block_op_matches(&ops[address], memory, address)) {
+      fprintf(stderr, "Ignoring corrupt block cache %s\n", path);
+      munmap(mapping, size);
+      return false;
+    }
+    loaded += ops[address].kind != BLOCK_OP_NONE;
+  }
+
+  free(cache->ops);
+  cache->ops = ops;
+  cache->mapping = mapping;
+  cache->mapping_size = size;
+  cache->loaded = loaded;
+  return true;
+}
+
+static bool make_parent_directories(char *path) {
+  for (char *slash = strchr(path + 1, '/'); slash;
+       slash = strchr(slash + 1, '/')) {
+    *slash = '\0';
+    bool made = mkdir(path, 0755) == 0 || errno == EEXIST;
+    *slash = '/';
+    if (!made) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool block_cache_save(struct BlockCache *cache, const char *path) {
+  // Ops decoded from code the program has overwritten only hold for this run
+  static const struct BlockOp none;
+  struct BlockOp *ops = malloc(MEMORY_SIZE * sizeof(struct BlockOp));
+  if (!ops) {
+    return false;
+  }
+  for (int address = 0; address < MEMORY_SIZE; address++) {
+    ops[address] = cache->ops[address];
+    for (int i = 0; i < 2 * ops[address].count; i++) {
+      if (address + i >= MEMORY_SIZE || cache->written[address + i]) {
+        ops[address] = none;
+        break;
+      }
+    }
+  }
+
+  struct BlockCacheHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, BLOCK_CACHE_MAGIC, sizeof(header.magic));
+  header.version = BLOCK_CACHE_VERSION;
+  header.op_size = sizeof(struct BlockOp);
+  header.rom_size = cache->rom_size;
+  header.rom_hash = cache->rom_hash;
+  header.checksum =
+      fnv1a(FNV1A_OFFSET, ops, MEMORY_SIZE * sizeof(struct BlockOp));
+
+  // Write a temporary file and rename it over the old one, so that a
+  // concurrent launch never maps a half-written cache
+  char temporary[4096];
+  snprintf(temporary, sizeof(temporary), "%s.%d", path, (int)getpid());
+  FILE *file = NULL;
+  if (make_parent_directories(temporary)) {
+    file = fopen(temporary, "wb");
+  }
+  if (!file) {
+    fprintf(stderr, "Error writing block cache %s\n", path);
+    free(ops);
+    return false;
+  }
+
+  bool written =
+      fwrite(&header, sizeof(header), 1, file) == 1 &&
+      fwrite(ops, sizeof(struct BlockOp), MEMORY_SIZE, file) == MEMORY_SIZE;
+  written = fclose(file) == 0 && written;
+  free(ops);
+  if (!written || rename(temporary, path) != 0) {
+    fprintf(stderr, "Error writing block cache %s\n", path);
+    remove(temporary);
+    return false;
+  }
+
+  return true;
+}
+
+static void block_decode_op(struct BlockOp *op, struct Memory *memory,
+                            int address) {
+  unsigned short opcode = memory_read_short(memory, address);
+  bool has_next = address + 3 < MEMORY_SIZE;
+  unsigned short next = has_next ? memory_read_short(memory, address + 2) : 0;
+
+  memset(op, 0, sizeof(*op));
+  op->kind = BLOCK_OP_EXEC;
+  op->count = 1;
+  op->x = (opcode & 0x0F00) >> 8;
+  op->y = (opcode & 0x00F0) >> 4;
+  op->nn = opcode & 0x00FF;
+  op->nnn = opcode & 0x0FFF;
+  op->opcode = opcode;
+
+  switch (opcode & 0xF000) {
+  case 0x3000:
+  case 0x4000:
+  case 0x5000:
+  case 0x9000:
+    if (has_next && (next & 0xF000) == 0x1000) {
+      op->kind = BLOCK_OP_SKIP_JUMP;
+      op->count = 2;
+      op->nnn = next & 0x0FFF;
+      op->opcode2 = next;
+    }
+    break;
+  case 0x6000:
+    op->kind = BLOCK_OP_LOAD;
+    if (has_next && (next & 0xFF00) == (0x7000 | (opcode & 0x0F00))) {
+      op->kind = BLOCK_OP_LOAD_ADD;
+      op->count = 2;
+      op->nn += next & 0x00FF;
+      op->opcode2 = next;
+    }
+    break;
+  case 0x7000:
+    op->kind = BLOCK_OP_ADD;
+    break;
+  case 0xA000:
+    op->kind = BLOCK_OP_LOAD_I;
+    break;
+  case 0xF000:
+    switch (opcode & 0x00FF) {
+    case 0x1E:
+      op->kind = BLOCK_OP_ADD_I;
+      if (has_next && (next & 0xF0FF) == 0xF065) {
+        op->kind = BLOCK_OP_ADD_I_LOAD;
+        op->count = 2;
+        op->y = (next & 0x0F00) >> 8;
+        op->opcode2 = next;
+      }
+      break;
+    case 0x33:
+    case 0x55:
+      op->kind = BLOCK_OP_STORE;
+      break;
+    }
+    break;
+  }
+}
+
+static bool block_op_ends_block(const struct BlockOp *op) {
+  // Anything that may not fall through to the next instruction
+  if (op->kind == BLOCK_OP_SKIP_JUMP) {
+    return true;
+  }
+  if (op->kind != BLOCK_OP_EXEC) {
+    return false;
+  }
+
+  switch (op->opcode & 0xF000) {
+  case 0x0000:
+    return op->opcode == 0x00EE;
+  case 0x1000:
+  case 0x2000:
+  case 0x3000:
+  case 0x4000:
+  case 0x5000:
+  case 0x9000:
+  case 0xB000:
+  case 0xE000:
+    return true;
+  case 0xF000:
+    return (op->opcode & 0x00FF) == 0x0A;
+  default:
+    return false;
+  }
+}
+
+static void block_decode(struct BlockCache *cache, struct Memory *memory,
+                         int start) {
+  // Decode the basic block starting at start, up to the first branch or the
+  // first op that is already decoded
+  for (int address = start; address + 1 < MEMORY_SIZE;) {
+    struct BlockOp *op = &cache->ops[address];
+    if (op->kind != BLOCK_OP_NONE && address != start) {
+      break;
+    }
+
+    block_decode_op(op, memory, address);
+    cache->decoded++;
+    if (block_op_ends_block(op)) {
+      break;
+    }
+    address += 2 * op->count;
+  }
+}
+
+void block_cache_invalidate(struct BlockCache *cache, int address,
+                            int length) {
+  // Drop every op that covers one of the written bytes
+  int first = address - (BLOCK_OP_MAX_BYTES - 1);
+  int last = address + length - 1;
+  for (int i = first < 0 ? 0 : first; i <= last && i < MEMORY_SIZE; i++) {
+    cache->ops[i].kind = BLOCK_OP_NONE;
+  }
+  for (int i = address; i <= last && i < MEMORY_SIZE; i++) {
+    cache->written[i] = true;
+  }
+}
+
+void block_cache_invalidate_written(struct BlockCache *cache) {
+  // Memory was restored from a snapshot, so any address written since the
+  // program was loaded may hold different code again
+  for (int address = 0; address < MEMORY_SIZE; address++) {
+    if (cache->written[address]) {
+      block_cache_invalidate(cache, address, 1);
+    }
+  }
+}
+
+static int block_exec_op(struct BlockCache *cache, struct Chip8 *chip8,
+                         const struct BlockOp *op, int pc) {
+  // Execute a decoded op and return how many instructions it retired
+  struct Registers *registers = &chip8->registers;
+  chip8_begin_cycle(chip8);
+  registers->PC += 2;
+  int retired = 1;
+
+  switch (op->kind) {
+  case BLOCK_OP_LOAD:
+    registers->V[op->x] = op->nn;
+    break;
+  case BLOCK_OP_ADD:
+    registers->V[op->x] += op->nn;
+    break;
+  case BLOCK_OP_LOAD_I:
+    registers->I = op->nnn;
+    break;
+  case BLOCK_OP_ADD_I:
+    registers->I += registers->V[op->x];
+    break;
+  case BLOCK_OP_STORE: {
+    int address = registers->I;
+    chip8_exec(chip8, op->opcode);
+    block_cache_invalidate(cache, address, op->nn == 0x33 ? 3 : op->x + 1);
+  } break;
+  case BLOCK_OP_LOAD_ADD:
+    registers->V[op->x] = op->nn;
+    chip8_begin_cycle(chip8);
+    registers->PC += 2;
+    retired = 2;
+    break;
+  case BLOCK_OP_SKIP_JUMP: {
+    bool skip;
+    switch (op->opcode & 0xF000) {
+    case 0x3000:
+      skip = registers->V[op->x] == op->nn;
+      break;
+    case 0x4000:
+      skip = registers->V[op->x] != op->nn;
+      break;
+    case 0x5000:
+      skip = registers->V[op->x] == registers->V[op->y];
+      break;
+    default:
+      skip = registers->V[op->x] != registers->V[op->y];
+      break;
+    }
+    if (skip) {
+      registers->PC += 2;
+      break;
+    }
+
+    chip8_begin_cycle(chip8);
+    registers->PC += 2;
+    retired = 2;
+    if (op->nnn > pc + 2) {
+      registers->PC = op->nnn;
+    } else {
+      // Backwards jumps go through the interpreter to detect polling loops
+      chip8_exec(chip8, op->opcode2);
+    }
+  } break;
+  case BLOCK_OP_ADD_I_LOAD:
+    registers->I += registers->V[op->x];
+    chip8_begin_cycle(chip8);
+    registers->PC += 2;
+    retired = 2;
+    for (int i = 0; i <= op->y; i++) {
+      registers->V[i] = memory_read(&chip8->memory, registers->I + i);
+    }
+    break;
+  default:
+    chip8_exec(chip8, op->opcode);
+    break;
+  }
+
+  chip8->cycle += retired;
+  return retired;
+}
+
+int block_cache_step(struct BlockCache *cache, struct Chip8 *chip8,
+                     int budget) {
+  // Execute ops from PC, across branches, until the budget is spent or the
+  // program starts polling, and return how many instructions retired. An
+  // op only runs when all of its instructions fit in the budget, so frames
+  // end on the same instruction as in the interpreter.
+  int retired = 0;
+  do {
+    int pc = chip8->registers.PC;
+    struct BlockOp *op = NULL;
+    if (pc + 1 < MEMORY_SIZE) {
+      op = &cache->ops[pc];
+      if (op->kind == BLOCK_OP_NONE) {
+        block_decode(cache, &chip8->memory, pc);
+      }
+    }
+    if (!op || op->count > budget - retired) {
+      // Left to the interpreter, one instruction at a time
+      if (retired == 0) {
+        chip8_cycle(chip8);
+        retired = 1;
+      }
+      break;
+    }
+
+    retired += block_exec_op(cache, chip8, op, pc);
+  } while (retired < budget && chip8->idle == CHIP8_IDLE_NONE);
+
+  return retired;
+}
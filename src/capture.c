@@ -0,0 +1,318 @@
+#include "capture.h"
+#include <string.h>
+
+// Capture files start with a header followed by one record per frame:
+//
+//   header: "C8V1", u16 width, u16 height, u16 fps, u16 keyframe interval
+//   record: u32 frame number, u8 flags, u16 payload size, payload
+//
+// The payload is the frame packed to one bit per pixel, XORed with the
+// previous frame (or with a blank one for keyframes) and PackBits coded.
+// All integers are little-endian.
+#define CAPTURE_MAGIC "C8V1"
+#define CAPTURE_FLAG_SOUND 0x1
+#define CAPTURE_FLAG_KEYFRAME 0x2
+#define CAPTURE_PACKED_SIZE (DISPLAY_SIZE / 8)
+// Worst case PackBits output for CAPTURE_PACKED_SIZE bytes
+#define CAPTURE_PAYLOAD_MAX (CAPTURE_PACKED_SIZE + CAPTURE_PACKED_SIZE / 128 + 1)
+
+static void capture_write_u16(FILE *file, unsigned int value) {
+  fputc(value & 0xFF, file);
+  fputc((value >> 8) & 0xFF, file);
+}
+
+static void capture_write_u32(FILE *file, unsigned long value) {
+  capture_write_u16(file, value & 0xFFFF);
+  capture_write_u16(file, (value >> 16) & 0xFFFF);
+}
+
+static bool capture_read_u16(FILE *file, unsigned int *value) {
+  int low = fgetc(file);
+  int high = fgetc(file);
+  if (low == EOF || high == EOF) {
+    return false;
+  }
+  *value = low | high << 8;
+  return true;
+}
+
+static bool capture_read_u32(FILE *file, unsigned long *value) {
+  unsigned int low, high;
+  if (!capture_read_u16(file, &low) || !capture_read_u16(file, &high)) {
+    return false;
+  }
+  *value = low | (unsigned long)high << 16;
+  return true;
+}
+
+static void capture_pack(const struct Frame *frame, unsigned char *packed) {
+  const bool *pixels = &frame->pixels[0][0];
+  for (int i = 0; i < CAPTURE_PACKED_SIZE; i++) {
+    unsigned char byte = 0;
+    for (int bit = 0; bit < 8; bit++) {
+      byte = byte << 1 | pixels[i * 8 + bit];
+    }
+    packed[i] = byte;
+  }
+}
+
+static int capture_packbits(const unsigned char *input, int size,
+                            unsigned char *output) {
+  // Runs of 2 to 129 equal bytes become (257 - length, byte), anything else
+  // is copied as up to 128 literals prefixed by (length - 1)
+  int length = 0;
+  int i = 0;
+  while (i < size) {
+    int run = 1;
+    while (i + run < size && run < 129 && input[i + run] == input[i]) {
+      run++;
+    }
+    if (run > 1) {
+      output[length++] = 257 - run;
+      output[length++] = input[i];
+      i += run;
+      continue;
+    }
+
+    int literals = 1;
+    while (i + literals < size && literals < 128 &&
+           !(i + literals + 1 < size &&
+             input[i + literals] == input[i + literals + 1])) {
+      literals++;
+    }
+    output[length++] = literals - 1;
+    memcpy(&output[length], &input[i], literals);
+    length += literals;
+    i += literals;
+  }
+
+  return length;
+}
+
+static bool capture_unpackbits(const unsigned char *input, int size,
+                               unsigned char *output, int output_size) {
+  int length = 0;
+  int i = 0;
+  while (i < size) {
+    int control = input[i++];
+    if (control < 128) {
+      int literals = control + 1;
+      if (i + literals > size || length + literals > output_size) {
+        return false;
+      }
+      memcpy(&output[length], &input[i], literals);
+      length += literals;
+      i += literals;
+    } else {
+      int run = 257 - control;
+      if (i >= size || length + run > output_size) {
+        return false;
+      }
+      memset(&output[length], input[i++], run);
+      length += run;
+    }
+  }
+
+  return length == output_size;
+}
+
+static int capture_thread(void *data) {
+  struct Capture *capture = data;
+  unsigned char previous[CAPTURE_PACKED_SIZE] = {0};
+  unsigned char packed[CAPTURE_PACKED_SIZE];
+  unsigned char delta[CAPTURE_PACKED_SIZE];
+  unsigned char payload[CAPTURE_PAYLOAD_MAX];
+  unsigned long encoded = 0;
+
+  while (true) {
+    // Keep draining after capture_stop until the ring is empty
+    bool running = atomic_load(&capture->running);
+    const struct CaptureSlot *slot = spsc_front(&capture->ring);
+    if (slot == NULL) {
+      if (!running) {
+        break;
+      }
+      SDL_SemWaitTimeout(capture->ready, 100);
+      continue;
+    }
+
+    bool keyframe = encoded % CAPTURE_KEYFRAME_INTERVAL == 0;
+    if (slot->changed) {
+      capture_pack(slot->frame, packed);
+    } else {
+      memcpy(packed, previous, sizeof(packed));
+    }
+    for (int i = 0; i < CAPTURE_PACKED_SIZE; i++) {
+      delta[i] = keyframe ? packed[i] : packed[i] ^ previous[i];
+    }
+    int length = capture_packbits(delta, CAPTURE_PACKED_SIZE, payload);
+
+    capture_write_u32(capture->file, slot->number);
+    fputc((slot->sound ? CAPTURE_FLAG_SOUND : 0) |
+              (keyframe ? CAPTURE_FLAG_KEYFRAME : 0),
+          capture->file);
+    capture_write_u16(capture->file, length);
+    fwrite(payload, 1, length, capture->file);
+
+    memcpy(previous, packed, sizeof(previous));
+    encoded++;
+    spsc_pop(&capture->ring);
+  }
+
+  return 0;
+}
+
+bool capture_start(struct Capture *capture, const char *path) {
+  capture->file = fopen(path, "wb");
+  if (!capture->file) {
+    printf("Error: Could not open capture file %s\n", path);
+    return false;
+  }
+
+  fwrite(CAPTURE_MAGIC, 1, 4, capture->file);
+  capture_write_u16(capture->file, DISPLAY_WIDTH);
+  capture_write_u16(capture->file, DISPLAY_HEIGHT);
+  capture_write_u16(capture->file, FRAMES_PER_SECOND);
+  capture_write_u16(capture->file, CAPTURE_KEYFRAME_INTERVAL);
+
+  for (int i = 0; i < CAPTURE_RING_SIZE; i++) {
+    capture->slots[i].frame = &capture->frames[i];
+  }
+  spsc_init(&capture->ring, capture->slots, sizeof(capture->slots[0]),
+            CAPTURE_RING_SIZE);
+  capture->next_number = 0;
+  capture->dropped = false;
+  capture->ready = SDL_CreateSemaphore(0);
+  atomic_init(&capture->running, true);
+  capture->thread = SDL_CreateThread(capture_thread, "capture", capture);
+  if (capture->thread == NULL) {
+    fprintf(stderr, "SDL_CreateThread Error: %s\n", SDL_GetError());
+    fclose(capture->file);
+    SDL_DestroySemaphore(capture->ready);
+    return false;
+  }
+
+  return true;
+}
+
+bool capture_submit(struct Capture *capture, struct Frame **frame,
+                    bool changed, bool sound) {
+  // Called once per emulated frame, with changed false if it draws the same
+  // pixels as the last. A changed frame is taken by swapping *frame with a
+  // free one, which the caller fills before it next reports a change.
+  // Returns false if the frame was dropped because the encoder has fallen a
+  // whole ring behind; *frame is then left alone.
+  unsigned long number = capture->next_number++;
+  struct CaptureSlot *slot = spsc_back(&capture->ring);
+  if (slot == NULL) {
+    capture->dropped = capture->dropped || changed;
+    return false;
+  }
+
+  slot->number = number;
+  slot->sound = sound;
+  // The frame after a dropped change is always taken, since the one it
+  // would repeat never reached the encoder; *frame still holds that change
+  slot->changed = changed || capture->dropped;
+  capture->dropped = false;
+  if (slot->changed) {
+    struct Frame *taken = *frame;
+    *frame = slot->frame;
+    slot->frame = taken;
+  }
+
+  spsc_push(&capture->ring);
+  SDL_SemPost(capture->ready);
+  return true;
+}
+
+void capture_stop(struct Capture *capture) {
+  atomic_store(&capture->running, false);
+  SDL_SemPost(capture->ready);
+  SDL_WaitThread(capture->thread, NULL);
+  SDL_DestroySemaphore(capture->ready);
+  fclose(capture->file);
+}
+
+static void capture_write_y4m_frame(FILE *output, const unsigned char *packed) {
+  // Luma at PIXEL_SIZE scale, then neutral 4:2:0 chroma
+  static unsigned char luma[DISPLAY_HEIGHT * PIXEL_SIZE]
+                           [DISPLAY_WIDTH * PIXEL_SIZE];
+  for (int y = 0; y < DISPLAY_HEIGHT * PIXEL_SIZE; y++) {
+    for (int x = 0; x < DISPLAY_WIDTH * PIXEL_SIZE; x++) {
+      int i = (y / PIXEL_SIZE) * DISPLAY_WIDTH + x / PIXEL_SIZE;
+      luma[y][x] = packed[i / 8] & (0x80 >> (i % 8)) ? 235 : 16;
+    }
+  }
+
+  fputs("FRAME\n", output);
+  fwrite(luma, 1, sizeof(luma), output);
+  for (size_t i = 0; i < sizeof(luma) / 2; i++) {
+    fputc(128, output);
+  }
+}
+
+bool capture_export_y4m(const char *input_path, const char *output_path) {
+  FILE *input = fopen(input_path, "rb");
+  if (!input) {
+    printf("Error: Could not open file %s\n", input_path);
+    return false;
+  }
+
+  char magic[4];
+  unsigned int width, height, fps, keyframe_interval;
+  if (fread(magic, 1, 4, input) != 4 ||
+      memcmp(magic, CAPTURE_MAGIC, 4) != 0 ||
+      !capture_read_u16(input, &width) || !capture_read_u16(input, &height) ||
+      !capture_read_u16(input, &fps) ||
+      !capture_read_u16(input, &keyframe_interval) ||
+      width != DISPLAY_WIDTH || height != DISPLAY_HEIGHT) {
+    printf("Error: %s is not a capture file\n", input_path);
+    fclose(input);
+    return false;
+  }
+
+  FILE *output = fopen(output_path, "wb");
+  if (!output) {
+    printf("Error: Could not open file %s\n", output_path);
+    fclose(input);
+    return false;
+  }
+  fprintf(output, "YUV4MPEG2 W%d H%d F%u:1 Ip A1:1 C420jpeg\n",
+          DISPLAY_WIDTH * PIXEL_SIZE, DISPLAY_HEIGHT * PIXEL_SIZE, fps);
+
+  unsigned char frame[CAPTURE_PACKED_SIZE] = {0};
+  unsigned char delta[CAPTURE_PACKED_SIZE];
+  unsigned char payload[CAPTURE_PAYLOAD_MAX];
+  unsigned long expected = 0;
+  unsigned long number;
+  bool ok = true;
+
+  while (capture_read_u32(input, &number)) {
+    int flags = fgetc(input);
+    unsigned int length;
+    if (flags == EOF || !capture_read_u16(input, &length) ||
+        length > sizeof(payload) ||
+        fread(payload, 1, length, input) != length ||
+        !capture_unpackbits(payload, length, delta, sizeof(delta))) {
+      printf("Error: %s is truncated or corrupt\n", input_path);
+      ok = false;
+      break;
+    }
+
+    // Hold the last frame over frames the capture had to drop
+    for (; expected < number; expected++) {
+      capture_write_y4m_frame(output, frame);
+    }
+
+    for (int i = 0; i < CAPTURE_PACKED_SIZE; i++) {
+      frame[i] = flags & CAPTURE_FLAG_KEYFRAME ? delta[i] : frame[i] ^ delta[i];
+    }
+    capture_write_y4m_frame(output, frame);
+    expected = number + 1;
+  }
+
+  fclose(input);
+  fclose(output);
+  return ok;
+}
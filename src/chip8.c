@@ -35,6 +35,40 @@ void chip8_init(struct Chip8 *chip8) {
 
   // Set the keyboard keys to zero
   memset(&chip8->keyboard.keys, 0, sizeof(chip8->keyboard.keys));
+  chip8->keyboard.last_pressed = -1;
+
+  // No polling loop has been seen yet
+  chip8->idle = CHIP8_IDLE_NONE;
+  chip8->idle_loop_start = MEMORY_SIZE;
+  chip8->idle_loop_end = MEMORY_SIZE;
+
+  // XO-CHIP starts at pitch 64, a pattern rate of 4000 bits per second
+  chip8->pitch = 64;
+
+  // Seed the random number generator from the clock
+  chip8_seed(chip8, time(NULL) ^ clock());
+}
+
+void chip8_seed(struct Chip8 *chip8, unsigned int seed) {
+  chip8->rng = chip8_random_state(seed);
+}
+
+void chip8_copy_state(struct Chip8 *chip8, const struct Chip8 *from) {
+  // Only the machine itself: the sound log belongs to whoever drains it
+  chip8->memory = from->memory;
+  chip8->registers = from->registers;
+  chip8->stack = from->stack;
+  chip8->keyboard = from->keyboard;
+  chip8->display = from->display;
+  chip8->idle = from->idle;
+  chip8->idle_loop_start = from->idle_loop_start;
+  chip8->idle_loop_end = from->idle_loop_end;
+  chip8->waiting_for_key = from->waiting_for_key;
+  chip8->rng = from->rng;
+  chip8->cycle = from->cycle;
+  memcpy(chip8->audio_pattern, from->audio_pattern,
+         sizeof(chip8->audio_pattern));
+  chip8->pitch = from->pitch;
 }
 
 void chip8_load_program(struct Chip8 *chip8, const unsigned char *program,
@@ -62,19 +96,62 @@ void chip8_load_program(struct Chip8 *chip8, const unsigned char *program,
   memset(&chip8->keyboard.keys, 0, sizeof(chip8->keyboard.keys));
 }
 
-static char chip8_wait_for_keypress(struct Chip8 *chip8) {
-  SDL_Event event;
-  while (SDL_WaitEvent(&event)) {
-    if (event.type == SDL_KEYDOWN) {
-      char key = event.key.keysym.sym;
-      char virtual_key = keyboard_map_key(&chip8->keyboard, key);
-      if (virtual_key != -1) {
-        return virtual_key;
+void chip8_log_sound(struct Chip8 *chip8, enum Chip8SoundEvent type) {
+  if (chip8->sound_log_count == SOUND_LOG_SIZE) {
+    return;
+  }
+
+  struct Chip8Sound *sound = &chip8->sound_log[chip8->sound_log_count++];
+  sound->cycle = chip8->cycle;
+  sound->type = type;
+  sound->pitch = chip8->pitch;
+  memcpy(sound->pattern, chip8->audio_pattern, sizeof(sound->pattern));
+}
+
+static enum Chip8Idle chip8_detect_idle_loop(struct Chip8 *chip8,
+                                             unsigned short start,
+                                             unsigned short end) {
+  // A polling loop is a short backwards jump over instructions that only test
+  // registers, read the delay timer or read the keypad. Until the next timer
+  // tick or key event another pass cannot change the machine state.
+  if (start > end || end - start > 2 * (IDLE_LOOP_MAX_LENGTH - 1)) {
+    return CHIP8_IDLE_NONE;
+  }
+
+  enum Chip8Idle idle = CHIP8_IDLE_TIMER;
+  for (unsigned short address = start; address < end; address += 2) {
+    unsigned short opcode = memory_read_short(&chip8->memory, address);
+    switch (opcode & 0xF000) {
+    case 0x3000:
+    case 0x4000:
+    case 0x5000:
+    case 0x9000:
+      break;
+    case 0xE000:
+      if ((opcode & 0x00FF) != 0x9E && (opcode & 0x00FF) != 0xA1) {
+        return CHIP8_IDLE_NONE;
+      }
+      idle = CHIP8_IDLE_KEY;
+      break;
+    case 0xF000:
+      if ((opcode & 0x00FF) != 0x07) {
+        return CHIP8_IDLE_NONE;
       }
+      break;
+    default:
+      return CHIP8_IDLE_NONE;
     }
   }
 
-  return -1;
+  // The first pass may still have read registers written later in the loop,
+  // so only a second consecutive pass is known to repeat itself
+  if (chip8->idle_loop_start != start || chip8->idle_loop_end != end) {
+    chip8->idle_loop_start = start;
+    chip8->idle_loop_end = end;
+    return CHIP8_IDLE_NONE;
+  }
+
+  return idle;
 }
 
 static void exec_0NNN(struct Chip8 *chip8, unsigned short opcode) {
@@ -195,20 +272,46 @@ static void exec_FXNN(struct Chip8 *chip8, unsigned short opcode) {
   unsigned char NN = opcode & 0x00FF;
 
   switch (NN) {
+  case 0x02:
+    // XO-CHIP F002: load the audio pattern from memory starting at I
+    if (X != 0) {
+      break;
+    }
+    for (int i = 0; i < AUDIO_PATTERN_SIZE; i++) {
+      chip8->audio_pattern[i] =
+          memory_read(&chip8->memory, chip8->registers.I + i);
+    }
+    chip8_log_sound(chip8, CHIP8_SOUND_PATTERN);
+    break;
   case 0x07:
     // Set V[X] to the value of the delay timer
     chip8->registers.V[X] = chip8->registers.delay_timer;
     break;
   case 0x0A:
     // Wait for a key press and store the value of the key in V[X]
-    chip8->registers.V[X] = chip8_wait_for_keypress(chip8);
+    if (!chip8->waiting_for_key) {
+      chip8->waiting_for_key = true;
+      chip8->keyboard.last_pressed = -1;
+    }
+    if (chip8->keyboard.last_pressed == -1) {
+      // Execute this instruction again until a key is pressed
+      chip8->registers.PC -= 2;
+      chip8->idle = CHIP8_IDLE_KEY;
+      break;
+    }
+    chip8->registers.V[X] = chip8->keyboard.last_pressed;
+    chip8->waiting_for_key = false;
     break;
   case 0x15:
     // Set the delay timer to V[X]
     chip8->registers.delay_timer = chip8->registers.V[X];
     break;
   case 0x18:
-    // Set the sound timer to V[X]
+    // Set the sound timer to V[X], the tone sounds while it is non-zero
+    if ((chip8->registers.sound_timer > 0) != (chip8->registers.V[X] > 0)) {
+      chip8_log_sound(chip8, chip8->registers.V[X] > 0 ? CHIP8_SOUND_ON
+                                                       : CHIP8_SOUND_OFF);
+    }
     chip8->registers.sound_timer = chip8->registers.V[X];
     break;
   case 0x1E:
@@ -230,6 +333,11 @@ static void exec_FXNN(struct Chip8 *chip8, unsigned short opcode) {
     memory_write(&chip8->memory, chip8->registers.I + 2,
                  chip8->registers.V[X] % 10);
     break;
+  case 0x3A:
+    // XO-CHIP FX3A: set the audio pattern pitch to V[X]
+    chip8->pitch = chip8->registers.V[X];
+    chip8_log_sound(chip8, CHIP8_SOUND_PITCH);
+    break;
   case 0x55:
     // Store V[0] to V[X] in memory starting at address I
     for (int i = 0; i <= X; i++) {
@@ -262,6 +370,7 @@ void chip8_exec(struct Chip8 *chip8, unsigned short opcode) {
     break;
   case 0x1000:
     // Jump to address NNN
+    chip8->idle = chip8_detect_idle_loop(chip8, NNN, chip8->registers.PC - 2);
     chip8->registers.PC = NNN;
     break;
   case 0x2000:
@@ -313,9 +422,8 @@ void chip8_exec(struct Chip8 *chip8, unsigned short opcode) {
     chip8->registers.PC = NNN + chip8->registers.V[0];
     break;
   case 0xC000:
-    srand(clock());
     // Set V[X] to a random number AND KK
-    chip8->registers.V[X] = (rand() % 255) & KK;
+    chip8->registers.V[X] = chip8_random(&chip8->rng) & KK;
     break;
   case 0xD000:
     exec_DXYN(chip8, opcode);
@@ -331,7 +439,19 @@ void chip8_exec(struct Chip8 *chip8, unsigned short opcode) {
   }
 }
 
+void chip8_begin_cycle(struct Chip8 *chip8) {
+  // Forget the polling loop once the program leaves it
+  if (chip8->registers.PC < chip8->idle_loop_start ||
+      chip8->registers.PC > chip8->idle_loop_end) {
+    chip8->idle_loop_start = MEMORY_SIZE;
+    chip8->idle_loop_end = MEMORY_SIZE;
+  }
+  chip8->idle = CHIP8_IDLE_NONE;
+}
+
 void chip8_cycle(struct Chip8 *chip8) {
+  chip8_begin_cycle(chip8);
+
   // Fetch the opcode
   unsigned short opcode =
       memory_read_short(&chip8->memory, chip8->registers.PC);
@@ -341,4 +461,16 @@ void chip8_cycle(struct Chip8 *chip8) {
 
   // Execute the opcode
   chip8_exec(chip8, opcode);
+  chip8->cycle++;
+}
+
+void chip8_tick_timers(struct Chip8 *chip8) {
+  // Both timers count down at FRAMES_PER_SECOND until they reach zero
+  if (chip8->registers.delay_timer > 0) {
+    chip8->registers.delay_timer--;
+  }
+  if (chip8->registers.sound_timer > 0 &&
+      --chip8->registers.sound_timer == 0) {
+    chip8_log_sound(chip8, CHIP8_SOUND_OFF);
+  }
 }
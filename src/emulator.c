@@ -0,0 +1,370 @@
+#include "emulator.h"
+#include <stdio.h>
+#include <string.h>
+
+void emulator_init(struct Emulator *emulator, struct Tone *tone,
+                   struct MetricsCounters *counters) {
+  chip8_init(&emulator->chip8);
+  input_queue_init(&emulator->input);
+  triple_buffer_init(&emulator->frames);
+  emulator->tone = tone;
+  emulator->capture = NULL;
+  emulator->capture_frame = &emulator->capture_frame_storage;
+  emulator->blocks = NULL;
+  emulator->frame_limit = 0;
+  emulator->input_delay = 0;
+  emulator->seats = 1;
+  rollback_init(&emulator->rollback);
+  emulator->has_unshown_input = false;
+  emulator->counters = counters;
+  emulator->frame_event = SDL_RegisterEvents(1);
+  atomic_init(&emulator->frame_event_pending, false);
+  atomic_init(&emulator->running, false);
+  emulator->thread = NULL;
+}
+
+int emulator_run_frame(struct Emulator *emulator,
+                       const struct RollbackFrame *frame) {
+  // Emulate one frame covering the host interval [start, start + frame_ms).
+  // Input events are applied at the cycle matching their timestamp.
+  struct Chip8 *chip8 = &emulator->chip8;
+  const struct InputEvent *events = frame->events;
+  unsigned long long frame_cycle = chip8->cycle;
+  int next = 0;
+  int cycle = 0;
+  int executed = 0;
+  while (cycle < CYCLES_PER_FRAME) {
+    Uint32 now = frame->start + cycle * frame->frame_ms / CYCLES_PER_FRAME;
+    int applied = 0;
+    while (next < frame->event_count &&
+           SDL_TICKS_PASSED(now, events[next].timestamp)) {
+      input_apply(&chip8->keyboard, &events[next++]);
+      applied++;
+    }
+    if (applied > 0 && chip8->idle == CHIP8_IDLE_KEY) {
+      chip8->idle = CHIP8_IDLE_NONE;
+    }
+
+    if (chip8->idle == CHIP8_IDLE_NONE) {
+      // Skipped cycles still pass on the emulated timeline
+      chip8->cycle = frame_cycle + cycle;
+      int retired = 1;
+      if (emulator->blocks) {
+        // Run up to the cycle the next event takes effect on
+        int until = CYCLES_PER_FRAME;
+        if (next < frame->event_count) {
+          until = cycle + 1;
+          while (until < CYCLES_PER_FRAME &&
+                 !SDL_TICKS_PASSED(frame->start + until * frame->frame_ms /
+                                                      CYCLES_PER_FRAME,
+                                   events[next].timestamp)) {
+            until++;
+          }
+        }
+        retired = block_cache_step(emulator->blocks, chip8, until - cycle);
+      } else {
+        chip8_cycle(chip8);
+      }
+      cycle += retired;
+      executed += retired;
+      continue;
+    }
+
+    // The program is spinning in a polling loop, so skip ahead to the cycle
+    // of the next input event in this frame or to the end of the frame
+    if (next == frame->event_count) {
+      break;
+    }
+    cycle = ((events[next].timestamp - frame->start) * CYCLES_PER_FRAME +
+             frame->frame_ms - 1) /
+            frame->frame_ms;
+  }
+
+  // Events after the last cycle take effect before the next frame
+  while (next < frame->event_count) {
+    input_apply(&chip8->keyboard, &events[next++]);
+  }
+  chip8->cycle = frame_cycle + CYCLES_PER_FRAME;
+  chip8->idle = CHIP8_IDLE_NONE;
+
+  return executed;
+}
+
+static bool emulator_input_due(const struct Emulator *emulator,
+                               const struct RollbackFrame *frame,
+                               const struct InputEvent *event) {
+  // With one seat an event is due once the frame reaches its timestamp.
+  // With several it is due in the frame it arrived for, input_delay frames
+  // later, even if that frame has already been emulated.
+  if (emulator->seats == 1) {
+    return !SDL_TICKS_PASSED(event->timestamp, frame->start + frame->frame_ms);
+  }
+  return event->frame + emulator->input_delay <= frame->number;
+}
+
+static void emulator_collect_input(struct Emulator *emulator,
+                                   struct RollbackFrame *frame) {
+  // Move the queued events that are due into the frame. With several seats,
+  // an event that missed an earlier frame goes back to that frame and marks
+  // it for re-simulation.
+  struct Rollback *rollback = &emulator->rollback;
+  struct InputEvent event;
+  while (input_queue_peek(&emulator->input, &event) &&
+         emulator_input_due(emulator, frame, &event)) {
+    input_queue_pop(&emulator->input);
+    if (!emulator->has_unshown_input ||
+        SDL_TICKS_PASSED(emulator->unshown_input, event.timestamp)) {
+      emulator->unshown_input = event.timestamp;
+      emulator->has_unshown_input = true;
+    }
+
+    struct RollbackFrame *target = frame;
+    if (emulator->seats > 1) {
+      unsigned long number = event.frame + emulator->input_delay;
+      if (number < rollback->oldest) {
+        number = rollback->oldest;
+      }
+      target = rollback_get(rollback, number);
+      rollback_mark(rollback, target);
+      // Events from outside the frame's interval take effect as it starts
+      if (SDL_TICKS_PASSED(event.timestamp, target->start + target->frame_ms) ||
+          !SDL_TICKS_PASSED(event.timestamp, target->start)) {
+        event.timestamp = target->start;
+      }
+    }
+    if (!rollback_add_event(target, &event)) {
+      fprintf(stderr, "Too many events in one frame, dropping key event\n");
+    }
+  }
+}
+
+static void emulator_capture(struct Emulator *emulator, struct Frame **frame,
+                             bool changed, bool sound) {
+  if (!capture_submit(emulator->capture, frame, changed, sound)) {
+    metrics_add(emulator->counters, METRIC_CAPTURE_DROPPED, 1);
+  }
+}
+
+static void emulator_keep_output(struct Emulator *emulator,
+                                 struct RollbackFrame *frame) {
+  // With several seats a frame can still be rolled back after it ran, so
+  // what it showed is kept with it until it is captured
+  if (emulator->capture && emulator->seats > 1) {
+    memcpy(frame->output->pixels, emulator->chip8.display.pixels,
+           sizeof(frame->output->pixels));
+    frame->sound = emulator->chip8.registers.sound_timer > 0;
+  }
+}
+
+static void emulator_resimulate(struct Emulator *emulator) {
+  // Restore the machine to the oldest frame that received late input and
+  // run it forward again with the corrected input, up to the current frame
+  struct Rollback *rollback = &emulator->rollback;
+  struct Chip8 *chip8 = &emulator->chip8;
+  unsigned long current = rollback->next - 1;
+  if (rollback->dirty >= current) {
+    return;
+  }
+
+  bool sounding = chip8->registers.sound_timer > 0;
+  unsigned long first = rollback->dirty;
+  chip8_copy_state(chip8, &rollback_get(rollback, first)->state);
+  if (emulator->blocks) {
+    block_cache_invalidate_written(emulator->blocks);
+  }
+  for (unsigned long number = first; number < current; number++) {
+    struct RollbackFrame *frame = rollback_get(rollback, number);
+    if (number > first) {
+      chip8_copy_state(&frame->state, chip8);
+    }
+    emulator_run_frame(emulator, frame);
+    emulator_keep_output(emulator, frame);
+    chip8_tick_timers(chip8);
+  }
+  rollback->dirty = rollback->next;
+
+  // The audio thread has already played the first run of these frames, so
+  // only switch the tone if the corrected run ends up in a different state
+  chip8->sound_log_count = 0;
+  if ((chip8->registers.sound_timer > 0) != sounding) {
+    chip8_log_sound(chip8, sounding ? CHIP8_SOUND_OFF : CHIP8_SOUND_ON);
+  }
+
+  // Present the corrected frame even if the current one draws nothing
+  chip8->display.draw_flag = true;
+
+  metrics_add(emulator->counters, METRIC_ROLLBACKS, 1);
+  metrics_add(emulator->counters, METRIC_FRAMES_RESIMULATED, current - first);
+}
+
+static void emulator_publish_frame(struct Emulator *emulator) {
+  // With several seats every frame is published, even if it draws nothing,
+  // since input is stamped with the frame the host last showed
+  struct Display *display = &emulator->chip8.display;
+  if (!display->draw_flag && emulator->seats == 1) {
+    return;
+  }
+
+  struct Frame *frame = triple_buffer_back(&emulator->frames);
+  memcpy(frame->pixels, display->pixels, sizeof(frame->pixels));
+  frame->number = emulator->rollback.next - 1;
+  frame->input_timestamp = emulator->unshown_input;
+  frame->has_input = emulator->has_unshown_input;
+  triple_buffer_publish(&emulator->frames);
+  display->draw_flag = false;
+  emulator->has_unshown_input = false;
+
+  // Wake the host thread, unless it has not handled the last wake up yet
+  if (!atomic_exchange(&emulator->frame_event_pending, true)) {
+    SDL_Event event;
+    memset(&event, 0, sizeof(event));
+    event.type = emulator->frame_event;
+    SDL_PushEvent(&event);
+  }
+}
+
+static void emulator_flush_sound(struct Emulator *emulator) {
+  // Hand the sound changes of the frame to the audio thread, along with the
+  // emulated time they have been rendered up to
+  struct Chip8 *chip8 = &emulator->chip8;
+  if (emulator->tone) {
+    for (int i = 0; i < chip8->sound_log_count; i++) {
+      tone_push(emulator->tone, &chip8->sound_log[i]);
+    }
+    synth_set_cycle(&emulator->tone->synth, chip8->cycle);
+  }
+  chip8->sound_log_count = 0;
+}
+
+int emulator_advance(struct Emulator *emulator, Uint32 start,
+                     Uint32 frame_ms) {
+  // Start a frame covering [start, start + frame_ms), take in its input,
+  // correct the earlier frames that input arrived late for, and emulate it
+  struct RollbackFrame *frame =
+      rollback_push(&emulator->rollback, start, frame_ms);
+  // The frame that had this slot has left the history and can no longer
+  // be rolled back, so its output is final
+  if (emulator->capture && emulator->seats > 1 &&
+      frame->number >= ROLLBACK_FRAMES) {
+    emulator_capture(emulator, &frame->output, true, frame->sound);
+  }
+  emulator_collect_input(emulator, frame);
+  if (emulator->seats > 1) {
+    emulator_resimulate(emulator);
+    chip8_copy_state(&frame->state, &emulator->chip8);
+  }
+
+  int executed = emulator_run_frame(emulator, frame);
+  emulator_keep_output(emulator, frame);
+  return executed;
+}
+
+static int emulator_thread(void *data) {
+  struct Emulator *emulator = data;
+
+  // Frame k is emulated at its deadline from the input of the interval
+  // that just ended, so the emulated timeline trails the host clock by
+  // exactly one frame: a cycle cannot run before its host time has passed
+  // without guessing the input. The finished frame is published at once and
+  // presented when the host wakes, so a key press is shown at the end of the
+  // interval it falls in, half a frame later on average.
+  // Deadlines are counted from an origin so that frames average exactly
+  // FRAMES_PER_SECOND, which the audio timeline relies on.
+  // The first frame runs straight away, over the interval just before the
+  // thread started, and is always published so the host has something to
+  // show as soon as possible.
+  const Uint32 frame_ms = 1000 / FRAMES_PER_SECOND;
+  Uint32 origin = SDL_GetTicks() - frame_ms;
+  unsigned long index = 0;
+  emulator->chip8.display.draw_flag = true;
+  unsigned long frames = 0;
+
+  while (atomic_load_explicit(&emulator->running, memory_order_relaxed)) {
+    Uint32 start = origin + index * 1000 / FRAMES_PER_SECOND;
+    Uint32 deadline = origin + (index + 1) * 1000 / FRAMES_PER_SECOND;
+    Uint32 now = SDL_GetTicks();
+    if (!SDL_TICKS_PASSED(now, deadline)) {
+      SDL_Delay(deadline - now);
+      continue;
+    }
+
+    // Input is held back by shifting the window of the frame into the past,
+    // or with several seats by emulator_input_due
+    Uint32 delay_ms = emulator->input_delay * 1000 / FRAMES_PER_SECOND;
+    int executed =
+        emulator_advance(emulator, start - delay_ms, deadline - start);
+    metrics_add(emulator->counters, METRIC_INSTRUCTIONS, executed);
+    metrics_add(emulator->counters, METRIC_FRAMES_EMULATED, 1);
+    if (emulator->chip8.waiting_for_key) {
+      metrics_add(emulator->counters, METRIC_KEY_WAIT_FRAMES, 1);
+    }
+
+    if (emulator->capture && emulator->seats == 1) {
+      // The display keeps being drawn on, so a change is snapshotted into
+      // the frame the capture takes in exchange for a free one
+      struct Display *display = &emulator->chip8.display;
+      if (display->draw_flag) {
+        memcpy(emulator->capture_frame->pixels, display->pixels,
+               sizeof(display->pixels));
+      }
+      emulator_capture(emulator, &emulator->capture_frame, display->draw_flag,
+                       emulator->chip8.registers.sound_timer > 0);
+    }
+    emulator_publish_frame(emulator);
+    chip8_tick_timers(&emulator->chip8);
+    emulator_flush_sound(emulator);
+
+    if (emulator->frame_limit && ++frames == emulator->frame_limit) {
+      SDL_Event event;
+      memset(&event, 0, sizeof(event));
+      event.type = SDL_QUIT;
+      SDL_PushEvent(&event);
+      break;
+    }
+
+    // Drop frames we are too late for rather than running them back to back
+    index++;
+    deadline = origin + (index + 1) * 1000 / FRAMES_PER_SECOND;
+    now = SDL_GetTicks();
+    if (SDL_TICKS_PASSED(now, deadline)) {
+      metrics_add(emulator->counters, METRIC_FRAMES_LATE, 1);
+      metrics_add(emulator->counters, METRIC_FRAMES_DROPPED,
+                  (now - deadline) / frame_ms);
+      origin = now;
+      index = 0;
+    }
+  }
+
+  // Nothing rolls back once the machine stops, so the frames still held
+  // back are final
+  if (emulator->capture && emulator->seats > 1) {
+    struct Rollback *rollback = &emulator->rollback;
+    for (unsigned long number = rollback->oldest; number < rollback->next;
+         number++) {
+      struct RollbackFrame *frame = rollback_get(rollback, number);
+      emulator_capture(emulator, &frame->output, true, frame->sound);
+    }
+  }
+
+  return 0;
+}
+
+bool emulator_start(struct Emulator *emulator) {
+  atomic_store(&emulator->running, true);
+  emulator->thread = SDL_CreateThread(emulator_thread, "emulator", emulator);
+  if (emulator->thread == NULL) {
+    fprintf(stderr, "SDL_CreateThread Error: %s\n", SDL_GetError());
+    atomic_store(&emulator->running, false);
+    return false;
+  }
+
+  return true;
+}
+
+void emulator_stop(struct Emulator *emulator) {
+  atomic_store(&emulator->running, false);
+  if (emulator->thread) {
+    SDL_WaitThread(emulator->thread, NULL);
+    emulator->thread = NULL;
+  }
+}
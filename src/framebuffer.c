@@ -0,0 +1,40 @@
+#include "framebuffer.h"
+#include <string.h>
+
+#define TRIPLE_BUFFER_FRESH 4
+#define TRIPLE_BUFFER_INDEX 3
+
+void triple_buffer_init(struct TripleBuffer *buffer) {
+  memset(buffer->frames, 0, sizeof(buffer->frames));
+  buffer->back = 0;
+  atomic_init(&buffer->middle, 1);
+  buffer->front = 2;
+}
+
+struct Frame *triple_buffer_back(struct TripleBuffer *buffer) {
+  return &buffer->frames[buffer->back];
+}
+
+void triple_buffer_publish(struct TripleBuffer *buffer) {
+  // Hand the finished back frame over and take whatever the consumer left
+  int middle = atomic_exchange_explicit(
+      &buffer->middle, buffer->back | TRIPLE_BUFFER_FRESH, memory_order_acq_rel);
+  buffer->back = middle & TRIPLE_BUFFER_INDEX;
+}
+
+bool triple_buffer_acquire(struct TripleBuffer *buffer) {
+  // Swap in the latest frame, if one was published since the last call
+  if (!(atomic_load_explicit(&buffer->middle, memory_order_relaxed) &
+        TRIPLE_BUFFER_FRESH)) {
+    return false;
+  }
+
+  int middle = atomic_exchange_explicit(&buffer->middle, buffer->front,
+                                        memory_order_acq_rel);
+  buffer->front = middle & TRIPLE_BUFFER_INDEX;
+  return true;
+}
+
+const struct Frame *triple_buffer_front(struct TripleBuffer *buffer) {
+  return &buffer->frames[buffer->front];
+}
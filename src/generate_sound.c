@@ -1,33 +1,23 @@
 #include "generate_sound.h"
 #include <alsa/asoundlib.h>
-#include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
 
 #define PCM_DEVICE "default"
-#define PI 3.14159265358979
-
-static void generate_sine_wave(int16_t *buffer, int samples, int frequency,
-                               int sample_rate) {
-  for (int i = 0; i < samples; i++) {
-    buffer[i] = 32767 * sin(2.0 * PI * frequency * i / sample_rate);
-  }
-}
-
-bool beep(int frequency, int duration, float volume) {
+static snd_pcm_t *open_pcm(unsigned int *sample_rate,
+                           snd_pcm_uframes_t *frames) {
+  // Keep the device buffer short, the synth latency has to cover it
+  snd_pcm_uframes_t buffer_size = 4 * *frames;
   snd_pcm_t *pcm_handle;
   snd_pcm_hw_params_t *params;
   snd_pcm_sw_params_t *sw_params;
   int dir;
-  int sample_rate = 44100;
   int channels = 1;
-  snd_pcm_uframes_t frames = 32;
-  int16_t *buffer;
 
   // Open PCM device for playback
   if (snd_pcm_open(&pcm_handle, PCM_DEVICE, SND_PCM_STREAM_PLAYBACK, 0) < 0) {
     fprintf(stderr, "Error opening PCM device %s\n", PCM_DEVICE);
-    return false;
+    return NULL;
   }
 
   // Allocate a hardware parameters object
@@ -41,44 +31,83 @@ bool beep(int frequency, int duration, float volume) {
                                SND_PCM_ACCESS_RW_INTERLEAVED);
   snd_pcm_hw_params_set_format(pcm_handle, params, SND_PCM_FORMAT_S16_LE);
   snd_pcm_hw_params_set_channels(pcm_handle, params, channels);
-  snd_pcm_hw_params_set_rate_near(pcm_handle, params, &sample_rate, &dir);
-  snd_pcm_hw_params_set_period_size_near(pcm_handle, params, &frames, &dir);
+  snd_pcm_hw_params_set_rate_near(pcm_handle, params, sample_rate, &dir);
+  snd_pcm_hw_params_set_period_size_near(pcm_handle, params, frames, &dir);
+  snd_pcm_hw_params_set_buffer_size_near(pcm_handle, params, &buffer_size);
 
   // Write the parameters to the driver
   if (snd_pcm_hw_params(pcm_handle, params) < 0) {
     fprintf(stderr, "Error setting HW params\n");
     snd_pcm_hw_params_free(params);
     snd_pcm_close(pcm_handle);
-    return false;
+    return NULL;
   }
 
   // Allocate software parameters structure and initialize it
   snd_pcm_sw_params_malloc(&sw_params);
   snd_pcm_sw_params_current(pcm_handle, sw_params);
-  snd_pcm_sw_params_set_avail_min(pcm_handle, sw_params, frames);
+  snd_pcm_sw_params_set_avail_min(pcm_handle, sw_params, *frames);
   snd_pcm_sw_params(pcm_handle, sw_params);
 
   // Use a buffer large enough to hold one period
-  snd_pcm_hw_params_get_period_size(params, &frames, &dir);
-  buffer = (int16_t *)malloc(frames * channels * sizeof(int16_t));
-  if (!buffer) {
-    fprintf(stderr, "Error allocating buffer\n");
-    snd_pcm_hw_params_free(params);
-    snd_pcm_close(pcm_handle);
-    return false;
-  }
+  snd_pcm_hw_params_get_period_size(params, frames, &dir);
 
-  // Generate a sine wave with adjusted volume
-  int buffer_samples = frames * channels;
-  int total_samples = sample_rate * duration / 1000;
-  for (int i = 0; i < total_samples; i += buffer_samples) {
-    generate_sine_wave(buffer, buffer_samples, frequency, sample_rate);
+  snd_pcm_hw_params_free(params);
+  snd_pcm_sw_params_free(sw_params);
+
+  return pcm_handle;
+}
+
+static int tone_thread(void *data) {
+  struct Tone *tone = data;
+  unsigned int sample_rate = 44100;
+  snd_pcm_uframes_t frames = SYNTH_PERIOD;
+  snd_pcm_t *pcm_handle = NULL;
+  int16_t *buffer = NULL;
+
+  while (atomic_load(&tone->running)) {
+    // Sleep while there is nothing but silence to play
+    if (synth_idle(&tone->synth)) {
+      if (pcm_handle) {
+        snd_pcm_drain(pcm_handle);
+        snd_pcm_prepare(pcm_handle);
+      }
 
-    // Adjust volume
-    for (int j = 0; j < buffer_samples; j++) {
-      buffer[j] = (int16_t)(buffer[j] * volume);
+      atomic_store(&tone->sleeping, true);
+      atomic_thread_fence(memory_order_seq_cst);
+      if (synth_idle(&tone->synth) && atomic_load(&tone->running)) {
+        SDL_SemWait(tone->wake);
+      }
+      atomic_store(&tone->sleeping, false);
+
+      // The output clock stopped while asleep, so catch up with the
+      // emulated timeline before rendering again
+      synth_sync(&tone->synth);
+      continue;
     }
 
+    // Open the device on the first sound, which keeps ALSA out of startup
+    if (!pcm_handle) {
+      pcm_handle = open_pcm(&sample_rate, &frames);
+      if (!pcm_handle) {
+        fprintf(stderr, "Sound is disabled\n");
+        return 1;
+      }
+      synth_set_rate(&tone->synth, sample_rate);
+      synth_sync(&tone->synth);
+
+      buffer = (int16_t *)malloc(frames * sizeof(int16_t));
+      if (!buffer) {
+        fprintf(stderr, "Error allocating buffer\n");
+        snd_pcm_close(pcm_handle);
+        return 1;
+      }
+    }
+
+    Uint64 start = metrics_now_ns();
+    synth_render(&tone->synth, buffer, frames);
+    metrics_add(tone->counters, METRIC_AUDIO_NS, metrics_now_ns() - start);
+
     // Write to PCM device
     int err = snd_pcm_writei(pcm_handle, buffer, frames);
     if (err == -EPIPE) {
@@ -86,21 +115,59 @@ bool beep(int frequency, int duration, float volume) {
       snd_pcm_prepare(pcm_handle);
     } else if (err < 0) {
       fprintf(stderr, "Error writing to PCM device: %s\n", snd_strerror(err));
-      free(buffer);
-      snd_pcm_drain(pcm_handle);
-      snd_pcm_close(pcm_handle);
-      snd_pcm_hw_params_free(params);
-      snd_pcm_sw_params_free(sw_params);
-      return false;
+      break;
     }
   }
 
   // Cleanup
   free(buffer);
-  snd_pcm_drain(pcm_handle);
-  snd_pcm_close(pcm_handle);
-  snd_pcm_hw_params_free(params);
-  snd_pcm_sw_params_free(sw_params);
+  if (pcm_handle) {
+    snd_pcm_drain(pcm_handle);
+    snd_pcm_close(pcm_handle);
+  }
+
+  return 0;
+}
+
+bool tone_start(struct Tone *tone, int frequency, float volume,
+                struct MetricsCounters *counters) {
+  synth_init(&tone->synth, frequency, volume);
+  atomic_init(&tone->running, true);
+  atomic_init(&tone->sleeping, false);
+  tone->counters = counters;
+  tone->thread = NULL;
+  tone->wake = SDL_CreateSemaphore(0);
+  if (tone->wake == NULL) {
+    fprintf(stderr, "SDL_CreateSemaphore Error: %s\n", SDL_GetError());
+    return false;
+  }
+
+  tone->thread = SDL_CreateThread(tone_thread, "audio", tone);
+  if (tone->thread == NULL) {
+    fprintf(stderr, "SDL_CreateThread Error: %s\n", SDL_GetError());
+    SDL_DestroySemaphore(tone->wake);
+    return false;
+  }
 
   return true;
 }
+
+void tone_push(struct Tone *tone, const struct Chip8Sound *sound) {
+  synth_push(&tone->synth, sound);
+
+  // Only wake the audio thread if it is asleep
+  atomic_thread_fence(memory_order_seq_cst);
+  if (atomic_exchange(&tone->sleeping, false)) {
+    SDL_SemPost(tone->wake);
+  }
+}
+
+void tone_stop(struct Tone *tone) {
+  atomic_store(&tone->running, false);
+  SDL_SemPost(tone->wake);
+
+  if (tone->thread) {
+    SDL_WaitThread(tone->thread, NULL);
+  }
+  SDL_DestroySemaphore(tone->wake);
+}
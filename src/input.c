@@ -0,0 +1,140 @@
+#include "input.h"
+#include <assert.h>
+#include <string.h>
+
+const unsigned char input_seat_keys[SEAT_COUNT][KEY_COUNT / SEAT_COUNT] = {
+    {0x1, 0x4, 0x7, 0xA, 0x2, 0x5, 0x8, 0x0},
+    {0xC, 0xD, 0xE, 0xF, 0x3, 0x6, 0x9, 0xB},
+};
+
+void input_map_init(
+    struct InputMap *map, const SDL_Scancode *scancodes,
+    const SDL_Scancode (*seat_scancodes)[KEY_COUNT / SEAT_COUNT], int seats) {
+  memset(map->keys, -1, sizeof(map->keys));
+
+  assert(seats >= 1 && seats <= SEAT_COUNT);
+  map->seats = seats;
+  if (seats == 1) {
+    for (int i = 0; i < KEY_COUNT; i++) {
+      assert(scancodes[i] >= 0 && scancodes[i] < SDL_NUM_SCANCODES);
+      map->keys[scancodes[i]] = i;
+    }
+  } else {
+    // Each seat's keys route to the keypad keys that seat owns
+    for (int seat = 0; seat < SEAT_COUNT; seat++) {
+      for (int i = 0; i < KEY_COUNT / SEAT_COUNT; i++) {
+        SDL_Scancode scancode = seat_scancodes[seat][i];
+        assert(scancode >= 0 && scancode < SDL_NUM_SCANCODES);
+        map->keys[scancode] = input_seat_keys[seat][i];
+      }
+    }
+  }
+
+  for (int i = 0; i < SEAT_COUNT; i++) {
+    map->controllers[i] = -1;
+  }
+}
+
+int input_map_key(const struct InputMap *map, SDL_Scancode scancode) {
+  if (scancode < 0 || scancode >= SDL_NUM_SCANCODES) {
+    return -1;
+  }
+
+  return map->keys[scancode];
+}
+
+int input_map_add_controller(struct InputMap *map, SDL_JoystickID id) {
+  // Seat the controller in the first empty seat, -1 if all are taken
+  for (int seat = 0; seat < map->seats; seat++) {
+    if (map->controllers[seat] == -1) {
+      map->controllers[seat] = id;
+      return seat;
+    }
+  }
+
+  return -1;
+}
+
+void input_map_remove_controller(struct InputMap *map, SDL_JoystickID id) {
+  for (int seat = 0; seat < map->seats; seat++) {
+    if (map->controllers[seat] == id) {
+      map->controllers[seat] = -1;
+    }
+  }
+}
+
+int input_map_controller_key(const struct InputMap *map, SDL_JoystickID id,
+                             SDL_GameControllerButton button) {
+  int seat = 0;
+  while (seat < map->seats && map->controllers[seat] != id) {
+    seat++;
+  }
+  if (seat == map->seats) {
+    return -1;
+  }
+
+  // The d-pad drives the outer column of the seat, the face buttons the
+  // inner one, so both paddles in PONG sit on the d-pad
+  switch (button) {
+  case SDL_CONTROLLER_BUTTON_DPAD_UP:
+    return input_seat_keys[seat][0];
+  case SDL_CONTROLLER_BUTTON_DPAD_DOWN:
+    return input_seat_keys[seat][1];
+  case SDL_CONTROLLER_BUTTON_DPAD_LEFT:
+    return input_seat_keys[seat][2];
+  case SDL_CONTROLLER_BUTTON_DPAD_RIGHT:
+    return input_seat_keys[seat][3];
+  case SDL_CONTROLLER_BUTTON_A:
+    return input_seat_keys[seat][4];
+  case SDL_CONTROLLER_BUTTON_B:
+    return input_seat_keys[seat][5];
+  case SDL_CONTROLLER_BUTTON_X:
+    return input_seat_keys[seat][6];
+  case SDL_CONTROLLER_BUTTON_Y:
+    return input_seat_keys[seat][7];
+  default:
+    return -1;
+  }
+}
+
+void input_queue_init(struct InputQueue *queue) {
+  spsc_init(&queue->ring, queue->events, sizeof(queue->events[0]),
+            INPUT_QUEUE_SIZE);
+}
+
+bool input_queue_push(struct InputQueue *queue,
+                      const struct InputEvent *event) {
+  // Drop the event if the consumer has fallen a whole queue behind
+  struct InputEvent *slot = spsc_back(&queue->ring);
+  if (slot == NULL) {
+    return false;
+  }
+
+  *slot = *event;
+  spsc_push(&queue->ring);
+  return true;
+}
+
+bool input_queue_peek(struct InputQueue *queue, struct InputEvent *event) {
+  const struct InputEvent *slot = spsc_front(&queue->ring);
+  if (slot == NULL) {
+    return false;
+  }
+
+  *event = *slot;
+  return true;
+}
+
+void input_queue_pop(struct InputQueue *queue) { spsc_pop(&queue->ring); }
+
+unsigned input_queue_size(struct InputQueue *queue) {
+  return spsc_size(&queue->ring);
+}
+
+void input_apply(struct Keyboard *keyboard, const struct InputEvent *event) {
+  if (event->pressed) {
+    keyboard_press(keyboard, event->key);
+  } else {
+    keyboard_release(keyboard, event->key);
+  }
+}
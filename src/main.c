@@ -1,113 +1,564 @@
+#include "batch.h"
+#include "block_cache.h"
+#include "capture.h"
 #include "chip8.h"
+#include "emulator.h"
 #include "generate_sound.h"
-#include "keyboard.h"
+#include "input.h"
+#include "metrics.h"
+#include "screen.h"
 #include <SDL2/SDL.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
-const char key_map[KEY_COUNT] = {
-    SDLK_1, SDLK_2, SDLK_3, SDLK_4, SDLK_q, SDLK_w, SDLK_e, SDLK_r,
-    SDLK_a, SDLK_s, SDLK_d, SDLK_f, SDLK_z, SDLK_x, SDLK_c, SDLK_v,
+const SDL_Scancode key_map[KEY_COUNT] = {
+    SDL_SCANCODE_1, SDL_SCANCODE_2, SDL_SCANCODE_3, SDL_SCANCODE_4,
+    SDL_SCANCODE_Q, SDL_SCANCODE_W, SDL_SCANCODE_E, SDL_SCANCODE_R,
+    SDL_SCANCODE_A, SDL_SCANCODE_S, SDL_SCANCODE_D, SDL_SCANCODE_F,
+    SDL_SCANCODE_Z, SDL_SCANCODE_X, SDL_SCANCODE_C, SDL_SCANCODE_V,
 };
 
-int main(int argc, char const *argv[]) {
-  if (argc < 2) {
-    printf("Usage: %s <program>\n", argv[0]);
+// With several seats each player gets a block of keys on their own side of
+// the keyboard, in the order of input_seat_keys: the outer keypad column
+// runs down the outer keyboard column, the inner one next to it
+const SDL_Scancode seat_key_map[SEAT_COUNT][KEY_COUNT / SEAT_COUNT] = {
+    {SDL_SCANCODE_1, SDL_SCANCODE_Q, SDL_SCANCODE_A, SDL_SCANCODE_Z,
+     SDL_SCANCODE_2, SDL_SCANCODE_W, SDL_SCANCODE_S, SDL_SCANCODE_X},
+    {SDL_SCANCODE_0, SDL_SCANCODE_P, SDL_SCANCODE_SEMICOLON,
+     SDL_SCANCODE_SLASH, SDL_SCANCODE_9, SDL_SCANCODE_O, SDL_SCANCODE_L,
+     SDL_SCANCODE_PERIOD},
+};
+
+static void queue_key(struct InputQueue *input, int key, Uint32 timestamp,
+                      unsigned long frame, bool pressed) {
+  if (key == -1) {
+    return;
+  }
+
+  struct InputEvent input_event = {
+      .timestamp = timestamp,
+      .frame = frame,
+      .key = key,
+      .pressed = pressed,
+  };
+  if (!input_queue_push(input, &input_event)) {
+    fprintf(stderr, "Input queue full, dropping key event\n");
+  }
+}
+
+// Map an SDL event into the input queue, stamped with the frame it arrived
+// for, returns false on quit
+static bool handle_event(const SDL_Event *event, struct InputMap *map,
+                         struct InputQueue *input, unsigned long frame) {
+  switch (event->type) {
+  case SDL_QUIT:
+    return false;
+  case SDL_KEYDOWN:
+  case SDL_KEYUP:
+    queue_key(input, input_map_key(map, event->key.keysym.scancode),
+              event->key.timestamp, frame, event->type == SDL_KEYDOWN);
+    break;
+  case SDL_CONTROLLERDEVICEADDED: {
+    SDL_GameController *controller =
+        SDL_GameControllerOpen(event->cdevice.which);
+    if (!controller) {
+      break;
+    }
+    SDL_JoystickID id =
+        SDL_JoystickInstanceID(SDL_GameControllerGetJoystick(controller));
+    int seat = input_map_add_controller(map, id);
+    if (seat == -1) {
+      SDL_GameControllerClose(controller);
+    } else {
+      printf("Controller %d took seat %d\n", id, seat + 1);
+    }
+  } break;
+  case SDL_CONTROLLERDEVICEREMOVED:
+    input_map_remove_controller(map, event->cdevice.which);
+    SDL_GameControllerClose(
+        SDL_GameControllerFromInstanceID(event->cdevice.which));
+    break;
+  case SDL_CONTROLLERBUTTONDOWN:
+  case SDL_CONTROLLERBUTTONUP:
+    queue_key(input,
+              input_map_controller_key(map, event->cbutton.which,
+                                       event->cbutton.button),
+              event->cbutton.timestamp, frame,
+              event->type == SDL_CONTROLLERBUTTONDOWN);
+    break;
+  }
+
+  return true;
+}
+
+// Keys machine holds during frame: one key, or none, for eight frames at a
+// time so the machines take different paths through the program like
+// players would
+static unsigned short batch_keys(int machine, int frame) {
+  unsigned int state = chip8_random_state((machine + 1) * 0x9E3779B9u ^
+                                          (frame / 8) * 0x85EBCA6Bu);
+  unsigned char roll = chip8_random(&state);
+  return roll & 0x10 ? 1 << (roll & 0xF) : 0;
+}
+
+static bool machines_match(const struct Chip8 *a, const struct Chip8 *b) {
+  return memcmp(&a->registers, &b->registers, sizeof(a->registers)) == 0 &&
+         memcmp(&a->stack, &b->stack, sizeof(a->stack)) == 0 &&
+         memcmp(&a->memory, &b->memory, sizeof(a->memory)) == 0 &&
+         memcmp(&a->display.pixels, &b->display.pixels,
+                sizeof(a->display.pixels)) == 0 &&
+         a->waiting_for_key == b->waiting_for_key && a->rng == b->rng;
+}
+
+// Run many copies of the program without a window, each with its own seed
+// and keys, and report the aggregate throughput
+static int run_batch(const unsigned char *program, size_t size, int machines,
+                     int frames) {
+  struct Batch batch;
+  if (!batch_init(&batch, machines, program, size)) {
+    printf("Error: Could not create a batch of %d machines\n", machines);
     return 1;
   }
 
-  const char *program_path = argv[1];
-  printf("Loading program: %s\n", program_path);
+  Uint64 start = metrics_now_ns();
+  batch_run(&batch, frames, batch_keys);
+  double elapsed = (metrics_now_ns() - start) / 1e9;
+
+  double steps = (double)machines * frames * CYCLES_PER_FRAME;
+  printf("%d machines x %d frames on %d thread%s: %.1f million "
+         "machine-steps/s\n",
+         machines, frames, batch.threads, batch.threads == 1 ? "" : "s",
+         steps / elapsed / 1e6);
 
-  FILE *file = fopen(program_path, "rb");
+  batch_free(&batch);
+  return 0;
+}
+
+// Whether seat holds its first key during frame: on and off for a quarter
+// second at a time, with the seats out of step
+static bool rollback_check_held(int seat, unsigned long frame) {
+  return (frame + seat * 7) / 15 % 2;
+}
+
+static void rollback_check_input(struct Emulator *emulator,
+                                 unsigned long frame) {
+  // Queue the key changes meant for frame
+  const Uint32 frame_ms = 1000 / FRAMES_PER_SECOND;
+  for (int seat = 0; frame > 0 && seat < SEAT_COUNT; seat++) {
+    bool held = rollback_check_held(seat, frame);
+    if (held == rollback_check_held(seat, frame - 1)) {
+      continue;
+    }
+    struct InputEvent event = {
+        .timestamp = frame * frame_ms,
+        .frame = frame,
+        .key = input_seat_keys[seat][0],
+        .pressed = held,
+    };
+    input_queue_push(&emulator->input, &event);
+  }
+}
+
+// Play the same two-seat input into two machines. One receives each key in
+// the frame it is meant for; the other receives it three frames late, as it
+// would from a host that fell behind. The late machine has to roll back and
+// end up exactly where the on-time one did.
+static int run_rollback_check(const unsigned char *program, size_t size) {
+  const unsigned long frames = 600;
+  const unsigned long lateness = 3;
+  const Uint32 frame_ms = 1000 / FRAMES_PER_SECOND;
+  struct Emulator *runs = malloc(2 * sizeof(struct Emulator));
+  struct MetricsCounters *counters = calloc(2, sizeof(struct MetricsCounters));
+  if (!runs || !counters) {
+    printf("Error: Could not allocate memory for the rollback check\n");
+    free(runs);
+    free(counters);
+    return 1;
+  }
+
+  for (int run = 0; run < 2; run++) {
+    struct Emulator *emulator = &runs[run];
+    emulator_init(emulator, NULL, &counters[run]);
+    emulator->seats = SEAT_COUNT;
+    chip8_seed(&emulator->chip8, 0);
+    chip8_load_program(&emulator->chip8, program, size);
+
+    unsigned long delay = run == 0 ? 0 : lateness;
+    for (unsigned long number = 0; number < frames; number++) {
+      // Keys stop changing before the end so the late run sees all of them
+      if (number >= delay && number - delay < frames - lateness) {
+        rollback_check_input(emulator, number - delay);
+      }
+      emulator_advance(emulator, number * frame_ms, frame_ms);
+      chip8_tick_timers(&emulator->chip8);
+      emulator->chip8.sound_log_count = 0;
+    }
+  }
+
+  unsigned long long rollbacks = counters[1].values[METRIC_ROLLBACKS];
+  unsigned long long resimulated =
+      counters[1].values[METRIC_FRAMES_RESIMULATED];
+  bool match = machines_match(&runs[0].chip8, &runs[1].chip8);
+  printf("Late input rolled back %llu times, re-simulating %llu frames\n",
+         rollbacks, resimulated);
+  printf("The late run %s the on-time run\n",
+         match ? "matches" : "does not match");
+
+  free(runs);
+  free(counters);
+  return match && rollbacks > 0 ? 0 : 1;
+}
+
+// A ROM file read into memory, possibly on its own thread
+struct Rom {
+  const char *path;
+  unsigned char *data;
+  long size;
+  Uint64 read_ns;
+};
+
+static int load_rom(void *data) {
+  struct Rom *rom = data;
+  Uint64 start = metrics_now_ns();
+  printf("Loading program: %s\n", rom->path);
+
+  FILE *file = fopen(rom->path, "rb");
   if (!file) {
-    printf("Error: Could not open file %s\n", program_path);
+    printf("Error: Could not open file %s\n", rom->path);
     return 1;
   }
 
   fseek(file, 0, SEEK_END);
-  long file_size = ftell(file);
+  rom->size = ftell(file);
   rewind(file);
 
-  unsigned char *program = (unsigned char *)malloc(file_size);
-  if (!program) {
+  rom->data = (unsigned char *)malloc(rom->size);
+  if (!rom->data) {
     printf("Error: Could not allocate memory for program\n");
+    fclose(file);
     return 1;
   }
 
-  size_t result = fread(program, 1, file_size, file);
-  if (result != file_size) {
-    printf("Error: Could not read file %s\n", program_path);
+  size_t result = fread(rom->data, 1, rom->size, file);
+  fclose(file);
+  if (result != rom->size) {
+    printf("Error: Could not read file %s\n", rom->path);
+    free(rom->data);
+    rom->data = NULL;
     return 1;
   }
-  printf("Program size: %ld bytes\n", file_size);
+  printf("Program size: %ld bytes\n", rom->size);
 
-  fclose(file);
+  rom->read_ns = metrics_now_ns() - start;
+  return 0;
+}
+
+#define STARTUP_MAX_PHASES 8
+
+// How long each phase of the launch took, reported once the first frame is
+// on screen so that printing does not slow the launch down
+struct Startup {
+  Uint64 start;
+  Uint64 last;
+  const char *names[STARTUP_MAX_PHASES];
+  Uint64 durations[STARTUP_MAX_PHASES];
+  int count;
+};
 
-  struct Chip8 chip8;
-  chip8_init(&chip8);
-  display_init(&chip8.display);
+static void startup_init(struct Startup *startup) {
+  startup->start = metrics_now_ns();
+  startup->last = startup->start;
+  startup->count = 0;
+}
+
+static void startup_phase(struct Startup *startup, const char *name) {
+  Uint64 now = metrics_now_ns();
+  if (startup->count < STARTUP_MAX_PHASES) {
+    startup->names[startup->count] = name;
+    startup->durations[startup->count++] = now - startup->last;
+  }
+  startup->last = now;
+}
+
+static void startup_report(const struct Startup *startup,
+                           const struct Rom *rom) {
+  for (int i = 0; i < startup->count; i++) {
+    fprintf(stderr, "startup: %-16s %7.2f ms\n", startup->names[i],
+            startup->durations[i] / 1e6);
+  }
+  fprintf(stderr, "startup: %-16s %7.2f ms, in parallel\n",
+          "rom read", rom->read_ns / 1e6);
+  fprintf(stderr, "startup: %-16s %7.2f ms\n", "to first frame",
+          (startup->last - startup->start) / 1e6);
+}
+
+static void usage(const char *name) {
+  printf("Usage: %s [options] <program>\n", name);
+  printf("  --metrics-socket <path>     serve metrics on a Unix socket\n");
+  printf("  --metrics-interval <secs>   dump metrics to stderr periodically\n");
+  printf("  --batch <machines>          run many copies of the program at once\n");
+  printf("  --batch-frames <frames>     frames to run in batch mode\n");
+  printf("  --headless                  run without a window or sound\n");
+  printf("  --frames <frames>           quit after this many frames\n");
+  printf("  --capture <file>            record every frame to a capture file\n");
+  printf("  --export-y4m <in> <out>     convert a capture file to Y4M video\n");
+  printf("  --seats <n>                 players sharing the keypad, with "
+         "rollback\n");
+  printf("  --input-delay <frames>      hold input back by this many frames\n");
+  printf("  --check-rollback            check that late input re-simulates "
+         "exactly\n");
+  printf("  --startup-report            time each phase up to the first "
+         "frame\n");
+  printf("  --no-block-cache            run the plain interpreter\n");
+}
+
+int main(int argc, char const *argv[]) {
+  struct Startup startup;
+  startup_init(&startup);
+
+  const char *program_path = NULL;
+  const char *metrics_socket = NULL;
+  int metrics_interval = 0;
+  int batch_machines = 0;
+  int batch_frames = 600;
+  bool headless = false;
+  long frame_limit = 0;
+  const char *capture_path = NULL;
+  int seats = 1;
+  int input_delay = 0;
+  bool report_startup = false;
+  bool use_blocks = true;
+  bool check_rollback = false;
+  const char *export_input = NULL;
+  const char *export_output = NULL;
+
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--metrics-socket") == 0 && i + 1 < argc) {
+      metrics_socket = argv[++i];
+    } else if (strcmp(argv[i], "--metrics-interval") == 0 && i + 1 < argc) {
+      metrics_interval = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--batch") == 0 && i + 1 < argc) {
+      batch_machines = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--batch-frames") == 0 && i + 1 < argc) {
+      batch_frames = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--headless") == 0) {
+      headless = true;
+    } else if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc) {
+      frame_limit = atol(argv[++i]);
+    } else if (strcmp(argv[i], "--capture") == 0 && i + 1 < argc) {
+      capture_path = argv[++i];
+    } else if (strcmp(argv[i], "--export-y4m") == 0 && i + 2 < argc) {
+      export_input = argv[++i];
+      export_output = argv[++i];
+    } else if (strcmp(argv[i], "--seats") == 0 && i + 1 < argc) {
+      seats = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--input-delay") == 0 && i + 1 < argc) {
+      input_delay = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--startup-report") == 0) {
+      report_startup = true;
+    } else if (strcmp(argv[i], "--no-block-cache") == 0) {
+      use_blocks = false;
+    } else if (strcmp(argv[i], "--check-rollback") == 0) {
+      check_rollback = true;
+    } else if (argv[i][0] != '-' && program_path == NULL) {
+      program_path = argv[i];
+    } else {
+      usage(argv[0]);
+      return 1;
+    }
+  }
+
+  if ((program_path == NULL && export_input == NULL) || batch_machines < 0 ||
+      batch_machines > BATCH_MAX_MACHINES || frame_limit < 0 || seats < 1 ||
+      seats > SEAT_COUNT || input_delay < 0) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  // Every exit from here on goes through the cleanup at the end, which
+  // only undoes what was set up
+  int status = 1;
+  struct Rom rom = {.path = program_path, .data = NULL};
+  struct Tone tone;
+  struct Screen screen;
+  bool window = false;
+  bool sound = false;
+  struct Emulator emulator;
+  struct Metrics metrics;
+  metrics_init(&metrics, &emulator.input);
+  struct MetricsCounters *counters = metrics_register(&metrics);
+  emulator_init(&emulator, headless ? NULL : &tone,
+                metrics_register(&metrics));
+  emulator.frame_limit = frame_limit;
+  emulator.seats = seats;
+  emulator.input_delay = input_delay;
+  struct BlockCache blocks;
+  char blocks_path[4096];
+  bool save_blocks = false;
+  struct Capture capture;
+  startup_phase(&startup, "setup");
+
+  if (export_input) {
+    status = capture_export_y4m(export_input, export_output) ? 0 : 1;
+    goto cleanup;
+  }
+  if (batch_machines > 0 || check_rollback) {
+    if (load_rom(&rom) != 0) {
+      goto cleanup;
+    }
+    status = check_rollback
+                 ? run_rollback_check(rom.data, rom.size)
+                 : run_batch(rom.data, rom.size, batch_machines, batch_frames);
+    goto cleanup;
+  }
+
+  // Read the ROM while SDL brings up the window
+  SDL_Thread *loader = SDL_CreateThread(load_rom, "loader", &rom);
+  if (loader == NULL) {
+    fprintf(stderr, "SDL_CreateThread Error: %s\n", SDL_GetError());
+    goto cleanup;
+  }
+
+  // Only the subsystems needed for the first frame; audio opens on the
+  // first sound and game controllers after the first frame
+  bool sdl_ready = SDL_Init(headless ? SDL_INIT_EVENTS
+                                     : SDL_INIT_VIDEO | SDL_INIT_EVENTS) == 0;
+  if (!sdl_ready) {
+    printf("SDL_Init Error: %s\n", SDL_GetError());
+  } else {
+    startup_phase(&startup, "sdl init");
+    if (!headless) {
+      screen_init(&screen);
+      window = true;
+      startup_phase(&startup, "window");
+    }
+  }
+
+  // The loader writes rom, so it is waited for even when SDL failed
+  int loaded;
+  SDL_WaitThread(loader, &loaded);
+  if (!sdl_ready || loaded != 0) {
+    goto cleanup;
+  }
 
   // load the program into memory
-  chip8_load_program(&chip8, program, file_size);
+  chip8_load_program(&emulator.chip8, rom.data, rom.size);
   printf("Program loaded successfully\n");
+  startup_phase(&startup, "rom load");
 
-  // initialize the keyboard
-  keyboard_init(&chip8.keyboard, key_map);
+  // Start from the blocks decoded by earlier runs of the same ROM
+  if (use_blocks && block_cache_init(&blocks, rom.data, rom.size)) {
+    save_blocks = block_cache_path(&blocks, blocks_path, sizeof(blocks_path));
+    if (save_blocks &&
+        block_cache_load(&blocks, blocks_path, &emulator.chip8.memory)) {
+      printf("Block cache loaded: %d ops\n", blocks.loaded);
+    }
+    emulator.blocks = &blocks;
+    startup_phase(&startup, "block cache");
+  }
+  free(rom.data);
+  rom.data = NULL;
 
-  // free the program memory
-  free(program);
+  // initialize the input pipeline
+  struct InputMap input_map;
+  input_map_init(&input_map, key_map, seat_key_map, seats);
 
-  if (SDL_Init(SDL_INIT_EVERYTHING) != 0) {
-    printf("SDL_Init Error: %s\n", SDL_GetError());
-    return 1;
+  if (capture_path) {
+    if (!capture_start(&capture, capture_path)) {
+      goto cleanup;
+    }
+    emulator.capture = &capture;
   }
 
+  // The core, its timers and the tone run on their own threads; this thread
+  // only queues input and presents the frames they publish
+  sound = !headless;
+  if (sound && !tone_start(&tone, 440, 0.1f, metrics_register(&metrics))) {
+    fprintf(stderr, "Sound is disabled\n");
+    emulator.tone = NULL;
+    sound = false;
+  }
+  if (!emulator_start(&emulator)) {
+    goto cleanup;
+  }
+  if (!metrics_start(&metrics, metrics_socket, metrics_interval)) {
+    fprintf(stderr, "Metrics are disabled\n");
+  }
+  startup_phase(&startup, "threads");
 
-  while (1) {
-    SDL_Event event;
-    while (SDL_PollEvent(&event)) {
-      switch (event.type) {
-      case SDL_QUIT:
-        goto out;
-        break;
-      case SDL_KEYDOWN: {
-        char key = event.key.keysym.sym;
-        int virtual_key = keyboard_map_key(&chip8.keyboard, key);
-        if (virtual_key != -1) {
-          keyboard_press(&chip8.keyboard, virtual_key);
+  bool first_frame = true;
+  // Input received from now on answers the frame on screen, so it is meant
+  // for the one after
+  unsigned long arrival = 0;
+  SDL_Event event;
+  while (SDL_WaitEvent(&event)) {
+    if (event.type == emulator.frame_event) {
+      atomic_store(&emulator.frame_event_pending, false);
+      bool fresh = triple_buffer_acquire(&emulator.frames);
+      const struct Frame *frame = triple_buffer_front(&emulator.frames);
+      if (fresh) {
+        arrival = frame->number + 1;
+      }
+      if (fresh && !headless) {
+        Uint64 start = metrics_now_ns();
+        // The window stays hidden until it has something to show
+        if (first_frame) {
+          SDL_ShowWindow(screen.window);
         }
-      } break;
-      case SDL_KEYUP: {
-        char key = event.key.keysym.sym;
-        int virtual_key = keyboard_map_key(&chip8.keyboard, key);
-        if (virtual_key != -1) {
-          keyboard_release(&chip8.keyboard, virtual_key);
+        screen_draw(&screen, frame);
+        metrics_add(counters, METRIC_DRAW_NS, metrics_now_ns() - start);
+        metrics_add(counters, METRIC_FRAMES_PRESENTED, 1);
+        if (frame->has_input) {
+          metrics_add(counters, METRIC_INPUT_LATENCY_MS,
+                      SDL_GetTicks() - frame->input_timestamp);
+          metrics_add(counters, METRIC_INPUT_LATENCY_SAMPLES, 1);
         }
-      } break;
       }
-    }
 
-    // implement a delay using delay_timer register
-    if (chip8.registers.delay_timer > 0) {
-      SDL_Delay(.1);
-      chip8.registers.delay_timer--;
+      if (first_frame) {
+        first_frame = false;
+        startup_phase(&startup, "first frame");
+        if (report_startup) {
+          startup_report(&startup, &rom);
+        }
+        if (seats > 1 && SDL_InitSubSystem(SDL_INIT_GAMECONTROLLER) != 0) {
+          fprintf(stderr, "Game controllers are disabled: %s\n",
+                  SDL_GetError());
+        }
+      }
+      continue;
     }
 
-    // implement sound
-    if (chip8.registers.sound_timer > 0) {
-      beep(440, 2 * chip8.registers.sound_timer, 0.1f);
-      chip8.registers.sound_timer = 0;
+    if (!handle_event(&event, &input_map, &emulator.input, arrival)) {
+      break;
     }
-
-    chip8_cycle(&chip8);
-    display_draw(&chip8.display);
   }
 
-out:
-  SDL_DestroyWindow(chip8.display.window);
+  status = 0;
+
+cleanup:
+  metrics_stop(&metrics);
+  emulator_stop(&emulator);
+  if (emulator.blocks) {
+    if (save_blocks) {
+      block_cache_save(&blocks, blocks_path);
+    }
+    block_cache_free(&blocks);
+  }
+  if (emulator.capture) {
+    capture_stop(&capture);
+  }
+  if (sound) {
+    tone_stop(&tone);
+  }
+  if (window) {
+    screen_free(&screen);
+  }
   SDL_Quit();
+  free(rom.data);
 
-  return 0;
+  return status;
 }
@@ -0,0 +1,300 @@
+#include "metrics.h"
+#include <assert.h>
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#define METRICS_BUFFER_SIZE 4096
+
+static const struct {
+  const char *name;
+  const char *type;
+  const char *help;
+  // Divisor turning the raw count into the exported unit
+  double scale;
+} metric_info[METRIC_COUNT] = {
+    [METRIC_INSTRUCTIONS] = {"chip8_instructions_total", "counter",
+                             "Instructions executed", 1},
+    [METRIC_FRAMES_EMULATED] = {"chip8_frames_emulated_total", "counter",
+                                "Frames emulated", 1},
+    [METRIC_FRAMES_PRESENTED] = {"chip8_frames_presented_total", "counter",
+                                 "Frames presented on screen", 1},
+    [METRIC_FRAMES_LATE] = {"chip8_frames_late_total", "counter",
+                            "Frames finished after their deadline", 1},
+    [METRIC_FRAMES_DROPPED] = {"chip8_frames_dropped_total", "counter",
+                               "Frames skipped to catch up with real time", 1},
+    [METRIC_DRAW_NS] = {"chip8_draw_seconds_total", "counter",
+                        "Time spent in display_draw", 1e9},
+    [METRIC_AUDIO_NS] = {"chip8_audio_seconds_total", "counter",
+                         "Time spent rendering audio periods", 1e9},
+    [METRIC_KEY_WAIT_FRAMES] = {"chip8_key_wait_seconds_total", "counter",
+                                "Emulated time spent blocked in FX0A",
+                                FRAMES_PER_SECOND},
+    [METRIC_CAPTURE_DROPPED] = {"chip8_capture_dropped_total", "counter",
+                                "Frames the capture encoder fell behind on",
+                                1},
+    [METRIC_ROLLBACKS] = {"chip8_rollbacks_total", "counter",
+                          "Rollbacks to frames that received late input", 1},
+    [METRIC_FRAMES_RESIMULATED] = {"chip8_frames_resimulated_total",
+                                   "counter",
+                                   "Frames emulated again after a rollback",
+                                   1},
+    [METRIC_INPUT_LATENCY_MS] = {"chip8_input_latency_seconds_total",
+                                 "counter",
+                                 "Time from key events to the first frame "
+                                 "presented after them",
+                                 1e3},
+    [METRIC_INPUT_LATENCY_SAMPLES] = {"chip8_input_latency_samples_total",
+                                      "counter",
+                                      "Key events timed to their first frame",
+                                      1},
+};
+
+void metrics_init(struct Metrics *metrics, struct InputQueue *input) {
+  memset(metrics->threads, 0, sizeof(metrics->threads));
+  atomic_init(&metrics->thread_count, 0);
+  metrics->input = input;
+  metrics->start = metrics_now_ns();
+  metrics->listen_fd = -1;
+  metrics->socket_path = NULL;
+  metrics->dump_interval = 0;
+  atomic_init(&metrics->running, false);
+  metrics->thread = NULL;
+}
+
+struct MetricsCounters *metrics_register(struct Metrics *metrics) {
+  int index = atomic_fetch_add(&metrics->thread_count, 1);
+  assert(index < METRICS_MAX_THREADS);
+  return &metrics->threads[index];
+}
+
+void metrics_read(struct Metrics *metrics,
+                  unsigned long long values[METRIC_COUNT]) {
+  memset(values, 0, METRIC_COUNT * sizeof(values[0]));
+
+  int count = atomic_load(&metrics->thread_count);
+  for (int i = 0; i < count; i++) {
+    for (int j = 0; j < METRIC_COUNT; j++) {
+      values[j] += atomic_load_explicit(&metrics->threads[i].values[j],
+                                        memory_order_relaxed);
+    }
+  }
+}
+
+static int metrics_format(struct Metrics *metrics, char *buffer, int size) {
+  unsigned long long values[METRIC_COUNT];
+  metrics_read(metrics, values);
+  double uptime = (metrics_now_ns() - metrics->start) / 1e9;
+
+  // Prometheus text exposition format
+  int length = 0;
+  for (int i = 0; i < METRIC_COUNT && length < size; i++) {
+    length += snprintf(buffer + length, size - length,
+                       "# HELP %s %s\n# TYPE %s %s\n%s %.9g\n",
+                       metric_info[i].name, metric_info[i].help,
+                       metric_info[i].name, metric_info[i].type,
+                       metric_info[i].name, values[i] / metric_info[i].scale);
+  }
+  if (length < size) {
+    length += snprintf(buffer + length, size - length,
+                       "# HELP chip8_instructions_per_second Average "
+                       "instructions executed per second\n"
+                       "# TYPE chip8_instructions_per_second gauge\n"
+                       "chip8_instructions_per_second %.9g\n"
+                       "# HELP chip8_input_queue_depth Input events waiting "
+                       "for the emulation thread\n"
+                       "# TYPE chip8_input_queue_depth gauge\n"
+                       "chip8_input_queue_depth %u\n"
+                       "# HELP chip8_uptime_seconds Seconds since start\n"
+                       "# TYPE chip8_uptime_seconds gauge\n"
+                       "chip8_uptime_seconds %.9g\n",
+                       uptime > 0 ? values[METRIC_INSTRUCTIONS] / uptime : 0,
+                       input_queue_size(metrics->input), uptime);
+  }
+
+  return length < size ? length : size - 1;
+}
+
+static bool metrics_send(int fd, const char *data, int length) {
+  // Write all of data, resuming after short writes and signals. MSG_NOSIGNAL
+  // keeps a client that hangs up early from killing the emulator with
+  // SIGPIPE.
+  while (length > 0) {
+    ssize_t sent = send(fd, data, length, MSG_NOSIGNAL);
+    if (sent < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return false;
+    }
+    data += sent;
+    length -= sent;
+  }
+
+  return true;
+}
+
+static void metrics_serve(struct Metrics *metrics) {
+  int fd = accept(metrics->listen_fd, NULL, NULL);
+  if (fd < 0) {
+    return;
+  }
+
+  // Any request gets the same answer, so both plain socket reads and HTTP
+  // clients such as curl --unix-socket work
+  char request[512];
+  struct pollfd pending = {.fd = fd, .events = POLLIN};
+  if (poll(&pending, 1, 100) > 0) {
+    ssize_t received;
+    do {
+      received = read(fd, request, sizeof(request));
+    } while (received < 0 && errno == EINTR);
+    if (received < 0) {
+      close(fd);
+      return;
+    }
+  }
+
+  char body[METRICS_BUFFER_SIZE];
+  int length = metrics_format(metrics, body, sizeof(body));
+  char header[128];
+  int header_length =
+      snprintf(header, sizeof(header),
+               "HTTP/1.0 200 OK\r\nContent-Type: text/plain; "
+               "version=0.0.4\r\nContent-Length: %d\r\n\r\n",
+               length);
+  if (metrics_send(fd, header, header_length)) {
+    metrics_send(fd, body, length);
+  }
+  close(fd);
+}
+
+static void metrics_dump(struct Metrics *metrics,
+                         unsigned long long previous[METRIC_COUNT]) {
+  unsigned long long values[METRIC_COUNT];
+  metrics_read(metrics, values);
+
+  double interval = metrics->dump_interval;
+  fprintf(stderr,
+          "metrics: %.0f instr/s, %.1f frames/s emulated, %.1f frames/s "
+          "presented, %llu late, %llu dropped, draw %.2f ms/s, audio %.2f "
+          "ms/s, input queue %u\n",
+          (values[METRIC_INSTRUCTIONS] - previous[METRIC_INSTRUCTIONS]) /
+              interval,
+          (values[METRIC_FRAMES_EMULATED] - previous[METRIC_FRAMES_EMULATED]) /
+              interval,
+          (values[METRIC_FRAMES_PRESENTED] -
+           previous[METRIC_FRAMES_PRESENTED]) /
+              interval,
+          values[METRIC_FRAMES_LATE] - previous[METRIC_FRAMES_LATE],
+          values[METRIC_FRAMES_DROPPED] - previous[METRIC_FRAMES_DROPPED],
+          (values[METRIC_DRAW_NS] - previous[METRIC_DRAW_NS]) / 1e6 / interval,
+          (values[METRIC_AUDIO_NS] - previous[METRIC_AUDIO_NS]) / 1e6 /
+              interval,
+          input_queue_size(metrics->input));
+
+  memcpy(previous, values, sizeof(values));
+}
+
+static int metrics_thread(void *data) {
+  struct Metrics *metrics = data;
+  unsigned long long previous[METRIC_COUNT] = {0};
+  Uint64 next_dump = metrics_now_ns() + metrics->dump_interval * 1000000000ULL;
+
+  while (atomic_load(&metrics->running)) {
+    // Wake up at least every 100 ms to notice metrics_stop
+    int timeout = 100;
+    if (metrics->dump_interval > 0) {
+      Uint64 now = metrics_now_ns();
+      if (now >= next_dump) {
+        metrics_dump(metrics, previous);
+        next_dump += metrics->dump_interval * 1000000000ULL;
+        continue;
+      }
+      if ((next_dump - now) / 1000000 < (Uint64)timeout) {
+        timeout = (next_dump - now) / 1000000;
+      }
+    }
+
+    struct pollfd listener = {.fd = metrics->listen_fd, .events = POLLIN};
+    if (poll(&listener, metrics->listen_fd >= 0 ? 1 : 0, timeout) > 0) {
+      metrics_serve(metrics);
+    }
+  }
+
+  return 0;
+}
+
+static int metrics_listen(const char *socket_path) {
+  struct sockaddr_un address;
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  if (strlen(socket_path) >= sizeof(address.sun_path)) {
+    fprintf(stderr, "Metrics socket path is too long: %s\n", socket_path);
+    return -1;
+  }
+  strcpy(address.sun_path, socket_path);
+
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0) {
+    perror("socket");
+    return -1;
+  }
+
+  // Replace the socket left behind by a previous instance
+  unlink(socket_path);
+  if (bind(fd, (struct sockaddr *)&address, sizeof(address)) < 0 ||
+      listen(fd, 4) < 0) {
+    perror("Metrics socket");
+    close(fd);
+    return -1;
+  }
+
+  return fd;
+}
+
+bool metrics_start(struct Metrics *metrics, const char *socket_path,
+                   int dump_interval) {
+  if (socket_path) {
+    metrics->listen_fd = metrics_listen(socket_path);
+    if (metrics->listen_fd < 0) {
+      return false;
+    }
+    metrics->socket_path = socket_path;
+  }
+  metrics->dump_interval = dump_interval;
+
+  if (metrics->listen_fd < 0 && metrics->dump_interval <= 0) {
+    return true;
+  }
+
+  atomic_store(&metrics->running, true);
+  metrics->thread = SDL_CreateThread(metrics_thread, "metrics", metrics);
+  if (metrics->thread == NULL) {
+    fprintf(stderr, "SDL_CreateThread Error: %s\n", SDL_GetError());
+    atomic_store(&metrics->running, false);
+    return false;
+  }
+
+  return true;
+}
+
+void metrics_stop(struct Metrics *metrics) {
+  atomic_store(&metrics->running, false);
+  if (metrics->thread) {
+    SDL_WaitThread(metrics->thread, NULL);
+    metrics->thread = NULL;
+  }
+  if (metrics->listen_fd >= 0) {
+    close(metrics->listen_fd);
+    metrics->listen_fd = -1;
+  }
+  if (metrics->socket_path) {
+    unlink(metrics->socket_path);
+    metrics->socket_path = NULL;
+  }
+}
@@ -0,0 +1,61 @@
+#include "rollback.h"
+
+void rollback_init(struct Rollback *rollback) {
+  rollback->oldest = 0;
+  rollback->next = 0;
+  rollback->dirty = 0;
+  for (int i = 0; i < ROLLBACK_FRAMES; i++) {
+    rollback->frames[i].output = &rollback->outputs[i];
+  }
+}
+
+struct RollbackFrame *rollback_push(struct Rollback *rollback, Uint32 start,
+                                    Uint32 frame_ms) {
+  // Start the next frame, reusing the slot of the oldest one once the
+  // history is full
+  bool clean = rollback->dirty == rollback->next;
+  struct RollbackFrame *frame = rollback_get(rollback, rollback->next);
+  frame->number = rollback->next++;
+  frame->start = start;
+  frame->frame_ms = frame_ms;
+  frame->event_count = 0;
+
+  if (rollback->next - rollback->oldest > ROLLBACK_FRAMES) {
+    rollback->oldest = rollback->next - ROLLBACK_FRAMES;
+  }
+  if (clean) {
+    rollback->dirty = rollback->next;
+  }
+
+  return frame;
+}
+
+struct RollbackFrame *rollback_get(struct Rollback *rollback,
+                                   unsigned long number) {
+  return &rollback->frames[number % ROLLBACK_FRAMES];
+}
+
+void rollback_mark(struct Rollback *rollback,
+                   const struct RollbackFrame *frame) {
+  // The newest frame is still to be emulated, so it never needs a rollback
+  if (frame->number + 1 < rollback->next && frame->number < rollback->dirty) {
+    rollback->dirty = frame->number;
+  }
+}
+
+bool rollback_add_event(struct RollbackFrame *frame,
+                        const struct InputEvent *event) {
+  if (frame->event_count == ROLLBACK_FRAME_EVENTS) {
+    return false;
+  }
+
+  // Keep the events of the frame in timestamp order
+  int i = frame->event_count++;
+  while (i > 0 && (Sint32)(frame->events[i - 1].timestamp -
+                           event->timestamp) > 0) {
+    frame->events[i] = frame->events[i - 1];
+    i--;
+  }
+  frame->events[i] = *event;
+  return true;
+}
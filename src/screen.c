@@ -0,0 +1,54 @@
+#include "screen.h"
+#include "config.h"
+#include <SDL2/SDL.h>
+
+void screen_init(struct Screen *screen) {
+  // Created hidden, the window is shown with the first frame
+  screen->window =
+      SDL_CreateWindow(EMULAOR_WINDOW_TITLE, SDL_WINDOWPOS_UNDEFINED,
+                       SDL_WINDOWPOS_UNDEFINED, DISPLAY_WIDTH * PIXEL_SIZE,
+                       DISPLAY_HEIGHT * PIXEL_SIZE, SDL_WINDOW_HIDDEN);
+  if (screen->window == NULL) {
+    printf("SDL_CreateWindow Error: %s\n", SDL_GetError());
+    SDL_Quit();
+    exit(1);
+  }
+
+  screen->renderer =
+      SDL_CreateRenderer(screen->window, -1, SDL_TEXTUREACCESS_TARGET);
+  if (screen->renderer == NULL) {
+    printf("SDL_CreateRenderer Error: %s\n", SDL_GetError());
+    SDL_Quit();
+    exit(1);
+  }
+
+  screen->texture = SDL_CreateTexture(
+      screen->renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING,
+      DISPLAY_WIDTH, DISPLAY_HEIGHT);
+  if (screen->texture == NULL) {
+    printf("SDL_CreateTexture Error: %s\n", SDL_GetError());
+    SDL_Quit();
+    exit(1);
+  }
+}
+
+void screen_draw(struct Screen *screen, const struct Frame *frame) {
+  // Upload the frame at its native size and let the renderer scale it
+  Uint32 texels[DISPLAY_HEIGHT][DISPLAY_WIDTH];
+  for (int y = 0; y < DISPLAY_HEIGHT; y++) {
+    for (int x = 0; x < DISPLAY_WIDTH; x++) {
+      texels[y][x] = frame->pixels[y][x] ? 0xFFFFFFFF : 0xFF000000;
+    }
+  }
+
+  SDL_UpdateTexture(screen->texture, NULL, texels, sizeof(texels[0]));
+  SDL_RenderClear(screen->renderer);
+  SDL_RenderCopy(screen->renderer, screen->texture, NULL, NULL);
+  SDL_RenderPresent(screen->renderer);
+}
+
+void screen_free(struct Screen *screen) {
+  SDL_DestroyTexture(screen->texture);
+  SDL_DestroyRenderer(screen->renderer);
+  SDL_DestroyWindow(screen->window);
+}
@@ -0,0 +1,51 @@
+#include "spsc.h"
+#include <assert.h>
+
+void spsc_init(struct Spsc *spsc, void *elements, size_t size,
+               unsigned capacity) {
+  assert(capacity > 0 && (capacity & (capacity - 1)) == 0);
+  spsc->elements = elements;
+  spsc->size = size;
+  spsc->capacity = capacity;
+  atomic_init(&spsc->head, 0);
+  atomic_init(&spsc->tail, 0);
+}
+
+void *spsc_back(struct Spsc *spsc) {
+  // The free slot the producer fills next, NULL if the consumer has fallen
+  // a whole ring behind
+  unsigned tail = atomic_load_explicit(&spsc->tail, memory_order_relaxed);
+  unsigned head = atomic_load_explicit(&spsc->head, memory_order_acquire);
+  if (tail - head == spsc->capacity) {
+    return NULL;
+  }
+
+  return spsc->elements + (tail & (spsc->capacity - 1)) * spsc->size;
+}
+
+void spsc_push(struct Spsc *spsc) {
+  unsigned tail = atomic_load_explicit(&spsc->tail, memory_order_relaxed);
+  atomic_store_explicit(&spsc->tail, tail + 1, memory_order_release);
+}
+
+void *spsc_front(struct Spsc *spsc) {
+  // The oldest published slot, NULL if the ring is empty
+  unsigned head = atomic_load_explicit(&spsc->head, memory_order_relaxed);
+  unsigned tail = atomic_load_explicit(&spsc->tail, memory_order_acquire);
+  if (head == tail) {
+    return NULL;
+  }
+
+  return spsc->elements + (head & (spsc->capacity - 1)) * spsc->size;
+}
+
+void spsc_pop(struct Spsc *spsc) {
+  unsigned head = atomic_load_explicit(&spsc->head, memory_order_relaxed);
+  atomic_store_explicit(&spsc->head, head + 1, memory_order_release);
+}
+
+unsigned spsc_size(struct Spsc *spsc) {
+  unsigned head = atomic_load_explicit(&spsc->head, memory_order_relaxed);
+  unsigned tail = atomic_load_explicit(&spsc->tail, memory_order_relaxed);
+  return tail - head;
+}
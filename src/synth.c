@@ -0,0 +1,237 @@
+#include "synth.h"
+#include <math.h>
+#include <string.h>
+
+#define PI 3.14159265358979
+// Cutoff of the band-limited step as a fraction of the sample rate, a little
+// under Nyquist to leave room for the window's transition band
+#define SYNTH_BLEP_CUTOFF 0.45
+
+static void synth_build_blep(struct Synth *synth) {
+  // Integrate a Blackman-windowed sinc into a band-limited step, then keep
+  // only its difference from the ideal step
+  const int size = SYNTH_BLEP_TAPS * SYNTH_BLEP_OVERSAMPLING + 1;
+  double integral[SYNTH_BLEP_TAPS * SYNTH_BLEP_OVERSAMPLING + 1];
+  double previous = 0;
+  double sum = 0;
+
+  for (int j = 0; j < size; j++) {
+    double x = (double)j / SYNTH_BLEP_OVERSAMPLING - SYNTH_BLEP_ZERO_CROSSINGS;
+    double w = x / SYNTH_BLEP_ZERO_CROSSINGS;
+    double window = 0.42 + 0.5 * cos(PI * w) + 0.08 * cos(2 * PI * w);
+    double arg = 2 * PI * SYNTH_BLEP_CUTOFF * x;
+    double sinc = x == 0 ? 1 : sin(arg) / arg;
+    double h = 2 * SYNTH_BLEP_CUTOFF * sinc * window;
+
+    if (j > 0) {
+      sum += (h + previous) / (2 * SYNTH_BLEP_OVERSAMPLING);
+    }
+    previous = h;
+    integral[j] = sum;
+  }
+
+  for (int j = 0; j < size; j++) {
+    double step = j >= SYNTH_BLEP_ZERO_CROSSINGS * SYNTH_BLEP_OVERSAMPLING;
+    synth->blep[j] = integral[j] / sum - step;
+  }
+  synth->blep[size] = synth->blep[size - 1];
+}
+
+void synth_init(struct Synth *synth, int frequency, float volume) {
+  spsc_init(&synth->queue, synth->events, sizeof(synth->events[0]),
+            SYNTH_QUEUE_SIZE);
+  atomic_init(&synth->cycle, 0);
+
+  synth->frequency = frequency;
+  synth->amplitude = volume;
+  synth->sample = 0;
+  synth->origin = 0;
+  synth->settled = SYNTH_BLEP_TAPS;
+
+  // Until a program loads a pattern, play a square at the tone frequency
+  synth->on = false;
+  synth->pitch = 64;
+  memset(synth->pattern, 0, sizeof(synth->pattern));
+  synth->pattern[0] = 0x80;
+  synth->pattern_bits = 2;
+  synth->phase = 0;
+  synth->level = 0;
+  memset(synth->line, 0, sizeof(synth->line));
+
+  synth_build_blep(synth);
+  synth_set_rate(synth, 44100);
+}
+
+void synth_set_rate(struct Synth *synth, int sample_rate) {
+  synth->samples_per_cycle =
+      (double)sample_rate / (CYCLES_PER_FRAME * FRAMES_PER_SECOND);
+  synth->square_increment = 2.0 * synth->frequency / sample_rate;
+
+  // XO-CHIP plays patterns at 4000 * 2 ^ ((pitch - 64) / 48) bits per second
+  for (int pitch = 0; pitch < 256; pitch++) {
+    synth->pitch_increment[pitch] =
+        4000.0 * pow(2.0, (pitch - 64) / 48.0) / sample_rate;
+  }
+
+  synth->increment = synth->pattern_bits == 2
+                         ? synth->square_increment
+                         : synth->pitch_increment[synth->pitch];
+}
+
+bool synth_push(struct Synth *synth, const struct Chip8Sound *sound) {
+  // Drop the change if the audio thread has fallen a whole queue behind
+  struct Chip8Sound *slot = spsc_back(&synth->queue);
+  if (slot == NULL) {
+    return false;
+  }
+
+  *slot = *sound;
+  spsc_push(&synth->queue);
+  return true;
+}
+
+void synth_set_cycle(struct Synth *synth, unsigned long long cycle) {
+  atomic_store_explicit(&synth->cycle, cycle, memory_order_relaxed);
+}
+
+static double synth_target(struct Synth *synth) {
+  // The emulated cycle the audio output should be at right now
+  unsigned long long cycle =
+      atomic_load_explicit(&synth->cycle, memory_order_relaxed);
+  return (double)cycle - SYNTH_LATENCY_FRAMES * CYCLES_PER_FRAME;
+}
+
+void synth_sync(struct Synth *synth) {
+  // Put the next sample SYNTH_LATENCY_FRAMES behind the emulated time
+  synth->origin = synth_target(synth) -
+                  (double)synth->sample / synth->samples_per_cycle;
+}
+
+bool synth_idle(struct Synth *synth) {
+  // Silent, with every step correction played out and no change pending
+  return !synth->on && synth->settled >= SYNTH_BLEP_TAPS &&
+         spsc_front(&synth->queue) == NULL;
+}
+
+static void synth_apply(struct Synth *synth, const struct Chip8Sound *sound) {
+  switch (sound->type) {
+  case CHIP8_SOUND_ON:
+    synth->on = true;
+    break;
+  case CHIP8_SOUND_OFF:
+    synth->on = false;
+    break;
+  case CHIP8_SOUND_PATTERN:
+    memcpy(synth->pattern, sound->pattern, sizeof(synth->pattern));
+    synth->pattern_bits = AUDIO_PATTERN_SIZE * 8;
+    synth->increment = synth->pitch_increment[synth->pitch];
+    break;
+  case CHIP8_SOUND_PITCH:
+    synth->pitch = sound->pitch;
+    if (synth->pattern_bits != 2) {
+      synth->increment = synth->pitch_increment[synth->pitch];
+    }
+    break;
+  }
+}
+
+static float synth_output_level(struct Synth *synth) {
+  if (!synth->on) {
+    return 0;
+  }
+
+  int bit = (int)synth->phase;
+  bool set = synth->pattern[bit / 8] & (0x80 >> (bit % 8));
+  return set ? synth->amplitude : -synth->amplitude;
+}
+
+static void synth_step(struct Synth *synth, float height, double offset) {
+  // Spread a step that happened offset samples before the current sample
+  // over the samples around it, using the precomputed band-limited step
+  for (int k = -SYNTH_BLEP_ZERO_CROSSINGS; k < SYNTH_BLEP_ZERO_CROSSINGS;
+       k++) {
+    double position =
+        (k + offset + SYNTH_BLEP_ZERO_CROSSINGS) * SYNTH_BLEP_OVERSAMPLING;
+    int index = (int)position;
+    float fraction = position - index;
+    float value = synth->blep[index] +
+                  (synth->blep[index + 1] - synth->blep[index]) * fraction;
+    synth->line[(synth->sample + k) % SYNTH_BLEP_TAPS] += height * value;
+  }
+}
+
+static void synth_advance(struct Synth *synth, double samples) {
+  synth->phase += samples * synth->increment;
+  if (synth->phase >= synth->pattern_bits) {
+    synth->phase -= synth->pattern_bits;
+  }
+}
+
+void synth_render(struct Synth *synth, int16_t *buffer, int samples) {
+  // Jump back onto the emulated timeline if the output has drifted off it,
+  // because one of the clocks runs fast or the emulator dropped frames
+  double position =
+      synth->origin + (double)synth->sample / synth->samples_per_cycle;
+  if (fabs(position - synth_target(synth)) >
+      SYNTH_LATENCY_FRAMES * CYCLES_PER_FRAME) {
+    synth_sync(synth);
+  }
+
+  for (int i = 0; i < samples; i++) {
+    // Walk the level changes between the previous sample and this one in
+    // time order: pattern bit boundaries and changes logged by the core
+    double now = (double)synth->sample;
+    double time = now - 1;
+
+    for (;;) {
+      double boundary =
+          time + (floor(synth->phase) + 1 - synth->phase) / synth->increment;
+      const struct Chip8Sound *sound = spsc_front(&synth->queue);
+      double change = INFINITY;
+      if (sound) {
+        change = ((double)sound->cycle - synth->origin) *
+                 synth->samples_per_cycle;
+      }
+
+      if (change <= now && change <= boundary) {
+        // Changes that are already late are applied straight away
+        if (change > time) {
+          synth_advance(synth, change - time);
+          time = change;
+        }
+        synth_apply(synth, sound);
+        spsc_pop(&synth->queue);
+      } else if (boundary <= now) {
+        synth->phase = floor(synth->phase) + 1;
+        if (synth->phase >= synth->pattern_bits) {
+          synth->phase -= synth->pattern_bits;
+        }
+        time = boundary;
+      } else {
+        synth_advance(synth, now - time);
+        break;
+      }
+
+      float level = synth_output_level(synth);
+      if (level != synth->level) {
+        synth_step(synth, level - synth->level, now - time);
+        synth->level = level;
+        synth->settled = 0;
+      }
+    }
+
+    // Emit the sample that has received all of its step corrections
+    synth->line[synth->sample % SYNTH_BLEP_TAPS] += synth->level;
+    float *out =
+        &synth->line[(synth->sample - SYNTH_BLEP_ZERO_CROSSINGS) %
+                     SYNTH_BLEP_TAPS];
+    float value = *out * 32767;
+    buffer[i] = value > 32767 ? 32767 : value < -32768 ? -32768 : value;
+    *out = 0;
+
+    synth->sample++;
+    if (synth->settled < SYNTH_BLEP_TAPS) {
+      synth->settled++;
+    }
+  }
+}